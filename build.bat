@@ -1,5 +1,18 @@
 :: This file is made only for me @jukeliv to build and test fast
 :: It may or not work on your machine ( even tho it's just like 2 gcc commands but, still )
 @echo off
-gcc ./src/vm.c ./src/main.c -o ./build/ptr -I./include/
-gcc ./src/assembler.c -o ./build/asm2ptr -I./include/
\ No newline at end of file
+:: libpointer ( the assembler and the VM, see include/pointer.h ), every tool links against it
+for %%f in (vm verify channel trace window heap server batch asm object pointer) do gcc -c ./src/%%f.c -o ./build/%%f.o -I./include/
+ar rcs ./build/libpointer.a ./build/vm.o ./build/verify.o ./build/channel.o ./build/trace.o ./build/window.o ./build/heap.o ./build/server.o ./build/batch.o ./build/asm.o ./build/object.o ./build/pointer.o
+
+gcc ./src/main.c -o ./build/ptr -I./include/ -L./build/ -lpointer -lpthread
+gcc ./src/assembler.c -o ./build/asm2ptr -I./include/ -L./build/ -lpointer -lpthread
+gcc ./src/ptr2c.c -o ./build/ptr2c -I./include/ -L./build/ -lpointer -lpthread
+gcc ./src/ptrtrace.c -o ./build/ptrtrace -I./include/ -L./build/ -lpointer -lpthread
+
+:: wide mode ( 32 bit addresses and registers )
+for %%f in (vm verify channel trace window heap server batch asm object pointer) do gcc -DPOINTER_WIDE -c ./src/%%f.c -o ./build/%%f32.o -I./include/
+ar rcs ./build/libpointer32.a ./build/vm32.o ./build/verify32.o ./build/channel32.o ./build/trace32.o ./build/window32.o ./build/heap32.o ./build/server32.o ./build/batch32.o ./build/asm32.o ./build/object32.o ./build/pointer32.o
+
+gcc -DPOINTER_WIDE ./src/main.c -o ./build/ptr32 -I./include/ -L./build/ -lpointer32 -lpthread
+gcc -DPOINTER_WIDE ./src/assembler.c -o ./build/asm2ptr32 -I./include/ -L./build/ -lpointer32 -lpthread
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pointer.h"
+
+/*
+    Runs the same program over a lot of inputs in lockstep, and once more
+    one input at a time to check both give the same results.
+    Build it against libpointer:
+        gcc -O2 ./examples/batch.c -o ./build/batch -I./include/ -L./build/ -lpointer -lpthread
+*/
+
+#define INPUTS 4096
+
+// steps until the Collatz sequence of a number reaches 1, every instance
+// takes a different path through the loop so they keep splitting up
+static const char* source =
+    "; the number comes in as two bytes, low first\n"
+    "mov 0x100 , rsp\n"
+    "mov 1 , *0x00\n"
+    "sys\n"
+    "sys\n"
+    "popb *0x14\n"
+    "popb *0x10\n"
+    "mov *0x14 , r1\n"
+    "shl r1 , 8\n"
+    "mov *0x10 , r1\n"
+    "or r0 , r1\n"
+    "mov r0 , r2\n"
+    "mov 1 , r1\n"
+    "mov 1000 , *0x1C   ; gives up after that many steps\n"
+    "%loop\n"
+    "jeq r2 , r1 , %done\n"
+    "jz r2 , %done\n"
+    "jeq *0x18 , *0x1C , %done\n"
+    "and r2 , 1\n"
+    "jnz r0 , %odd\n"
+    "shr r2 , 1\n"
+    "mov r0 , r2\n"
+    "jmp %next\n"
+    "%odd\n"
+    "mul r2 , 3\n"
+    "add r0 , 1\n"
+    "mov r0 , r2\n"
+    "%next\n"
+    "add *0x18 , 1\n"
+    "push r0\n"
+    "pop *0x18\n"
+    "jmp %loop\n"
+    "; the steps go out the same way, and stay in r2\n"
+    "%done\n"
+    "mov *0x18 , r2\n"
+    "mov 0 , *0x00\n"
+    "pushb *0x18\n"
+    "sys\n"
+    "mov 8 , *0x20\n"
+    "shr *0x18 , *0x20\n"
+    "push r0\n"
+    "pop *0x24\n"
+    "pushb *0x24\n"
+    "sys\n"
+    "hlt\n";
+
+static double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(void) {
+    static u8 image[POINTER_IMAGE_SIZE];
+    u32 image_size;
+    char error[256];
+    if(!pointer_assemble(source, strlen(source), image, &image_size, error, sizeof(error))) {
+        printf("ERROR: %s\n", error);
+        return 1;
+    }
+    vm_t* vm = pointer_create(image, image_size);
+    if(!vm)
+        return 1;
+
+    static u8 inputs[INPUTS][2];
+    static vm_io ios[INPUTS];
+    static batch_result results[INPUTS];
+    for(int i = 0; i < INPUTS; ++i) {
+        inputs[i][0] = (i + 1) & 0xFF;
+        inputs[i][1] = (i + 1) >> 8;
+        ios[i] = (vm_io){ .in = inputs[i], .in_size = 2 };
+    }
+
+    double start = seconds();
+    if(!pointer_run_batch(vm, INPUTS, ios, results)) {
+        pointer_destroy(vm);
+        return 1;
+    }
+    double lockstep = seconds() - start;
+
+    // one at a time, on the same VM
+    int wrong = 0;
+    vm_io io = { 0 };
+    vm->io = &io;
+    start = seconds();
+    for(int i = 0; i < INPUTS; ++i) {
+        vm_reset(vm);
+        io.in = inputs[i];
+        io.in_size = 2;
+        io.in_at = 0;
+        io.out_size = 0;
+        u8 trap = pointer_run(vm);
+        if(trap != results[i].trap || vm->r[2] != results[i].r[2] ||
+           io.out_size != ios[i].out_size || memcmp(io.out, ios[i].out, io.out_size))
+            ++wrong;
+    }
+    double alone = seconds() - start;
+
+    printf("steps of 27: %u\n", (u32)results[26].r[2]);
+    printf("%d instances, %.2f ms in lockstep, %.2f ms one at a time, %d different\n",
+        INPUTS, lockstep * 1e3, alone * 1e3, wrong);
+
+    for(int i = 0; i < INPUTS; ++i)
+        free(ios[i].out);
+    free(io.out);
+    vm->io = NULL;
+    pointer_destroy(vm);
+    return wrong != 0;
+}
\ No newline at end of file
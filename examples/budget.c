@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pointer.h"
+
+/*
+    Checks that a budget of n instructions runs exactly n of them, on both
+    interpreters ( verified and checked ), exits with 1 when it doesn't.
+    Build it against libpointer:
+        gcc ./examples/budget.c -o ./build/budget -I./include/ -L./build/ -lpointer -lpthread
+*/
+
+static const char* source =
+    "mov 0x100 , rsp\n"
+    "mov 10 , r1\n"
+    "%loop\n"
+    "jz r1 , %done\n"
+    "sub r1 , 1\n"
+    "mov r0 , r1\n"
+    "jmp %loop\n"
+    "%done\n"
+    "hlt\n";
+
+// 2 to set up, 4 per turn of the loop, then the last jz and the hlt
+#define INSTRUCTIONS (2 + 4 * 10 + 2)
+
+static u8 run(const u8* image, u32 image_size, bool verified, unsigned long long budget) {
+    vm_t* vm = pointer_create(image, image_size);
+    if(!vm)
+        return TrapNone;
+    vm->verified = vm->verified && verified;
+    vm->budget = budget;
+    u8 trap = pointer_run(vm);
+    pointer_destroy(vm);
+    return trap;
+}
+
+int main(void) {
+    static u8 image[POINTER_IMAGE_SIZE];
+    u32 image_size;
+    char error[256];
+    if(!pointer_assemble(source, strlen(source), image, &image_size, error, sizeof(error))) {
+        printf("ERROR: %s\n", error);
+        return 1;
+    }
+
+    int failed = 0;
+    for(int verified = 0; verified < 2; ++verified) {
+        const char* name = verified ? "verified" : "checked";
+        u8 trap = run(image, image_size, verified, INSTRUCTIONS);
+        if(trap != TrapNone) {
+            printf("ERROR: %s, a budget of %u trapped, %s\n", name, INSTRUCTIONS, vm_trap_names[trap]);
+            failed = 1;
+        }
+        trap = run(image, image_size, verified, INSTRUCTIONS - 1);
+        if(trap != TrapBudget) {
+            printf("ERROR: %s, a budget of %u didn't run out, %s\n", name, INSTRUCTIONS - 1, vm_trap_names[trap]);
+            failed = 1;
+        }
+    }
+    if(!failed)
+        printf("a budget of %u runs %u instructions\n", INSTRUCTIONS, INSTRUCTIONS);
+    return failed;
+}
\ No newline at end of file
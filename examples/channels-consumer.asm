@@ -0,0 +1,26 @@
+mov 0x100 , rsp
+
+; create channel 0, whoever gets there first creates it
+mov 4 , *0x10
+mov 0 , *0x12
+push *0x10
+push *0x12
+mov 3 , *0x00
+sys
+
+; wait for a message of up to 8 bytes into *0x30
+mov 8 , *0x14
+mov 0x30 , *0x16
+push *0x14
+push *0x16
+push *0x12
+mov 5 , *0x00
+sys
+; amount of bytes received
+pop *0x18
+
+; print the first byte
+pushb *0x30
+mov 0 , *0x00
+sys
+hlt
\ No newline at end of file
@@ -0,0 +1,24 @@
+; run together with channels-consumer.asm:
+;   ptr channels-consumer.ptr channels-producer.ptr
+
+; move the stack away from the syscall number at *0x00
+mov 0x100 , rsp
+
+; create channel 0 with room for 4 messages
+mov 4 , *0x10
+mov 0 , *0x12
+push *0x10
+push *0x12
+mov 3 , *0x00
+sys
+
+; send the single byte message stored at *0x20
+mov 'h' , *0x20
+mov 1 , *0x14
+mov 0x20 , *0x16
+push *0x14
+push *0x16
+push *0x12
+mov 4 , *0x00
+sys
+hlt
\ No newline at end of file
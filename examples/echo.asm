@@ -0,0 +1,16 @@
+; writes back everything it reads, made for the server mode:
+;   ptr --serve /tmp/ptr.sock echo.ptr
+mov 0x100 , rsp
+mov 0xFF , *0x14    ; what getchar gives once the input is over
+%loop
+  mov 0 , *0x10
+  mov 1 , *0x00
+  sys
+  popb *0x10
+  jeq *0x10 , *0x14 , %done
+  pushb *0x10
+  mov 0 , *0x00
+  sys
+  jmp %loop
+%done
+hlt
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pointer.h"
+
+/*
+    Runs a program straight from a string on a few threads at once.
+    Build it against libpointer:
+        gcc ./examples/embed.c -o ./build/embed -I./include/ -L./build/ -lpointer -lpthread
+*/
+
+#define THREADS 4
+
+static const char* source =
+    "; *0x14 = 1 + 2 + ... + *0x10\n"
+    "mov 0x100 , rsp\n"
+    "%loop\n"
+    "jeq *0x12 , *0x10 , %done\n"
+    "; add leaves its result in r0\n"
+    "add *0x12 , 1\n"
+    "push r0\n"
+    "pop *0x12\n"
+    "add *0x14 , *0x12\n"
+    "push r0\n"
+    "pop *0x14\n"
+    "jmp %loop\n"
+    "%done\n"
+    "hlt\n";
+
+static void* run(void* arg) {
+    word n = (word)(size_t)arg;
+
+    // every thread assembles its own copy, just to show it can
+    u8* image = malloc(POINTER_IMAGE_SIZE);
+    u32 image_size;
+    char error[256];
+    if(!pointer_assemble(source, strlen(source), image, &image_size, error, sizeof(error))) {
+        printf("ERROR: %s\n", error);
+        free(image);
+        return NULL;
+    }
+
+    vm_t* vm = pointer_create(image, image_size);
+    free(image);
+    if(!vm)
+        return NULL;
+    pointer_write(vm, 0x10, &n, sizeof(n));
+
+    u8 trap = pointer_run(vm);
+    if(trap)
+        printf("ERROR: trapped, %s\n", vm_trap_names[trap]);
+    else {
+        word sum;
+        pointer_read(vm, 0x14, &sum, sizeof(sum));
+        printf("sum up to %u = %u\n", (u32)n, (u32)sum);
+    }
+
+    pointer_destroy(vm);
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[THREADS];
+    for(int i = 0; i < THREADS; ++i)
+        pthread_create(&threads[i], NULL, run, (void*)(size_t)(10 * (i + 1)));
+    for(int i = 0; i < THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    return 0;
+}
\ No newline at end of file
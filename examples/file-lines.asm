@@ -0,0 +1,93 @@
+; counts the lines of a host file, scanning it through a window that
+; slides over the file instead of reading it a byte at a time:
+;   ptr --file notes.txt file-lines.ptr
+mov 0x100 , rsp
+
+; map 0x1000 bytes of file 0, from its first page, at 0x1000
+mov 0 , *0x10       ; page
+mov 0x1000 , *0x14  ; size
+mov 0x1000 , *0x18  ; addr
+mov 0 , *0x1C       ; file
+push *0x10
+push *0x14
+push *0x18
+push *0x1C
+mov 7 , *0x00
+sys
+pop *0x20           ; bytes of the file in the window
+
+; (word)-1 when the file couldn't be mapped
+not *0x20
+jz r0 , %failed
+mov 0 , *0x24       ; lines
+
+%scan
+  ; r2 walks the window until r1, the end of the file bytes in it
+  mov *0x20 , r1
+  add r1 , 0x1000
+  mov r0 , r1
+  mov 0x1000 , r2
+%byte
+  jeq r2 , r1 , %slide
+  mov [r2+0] , r0
+  and r0 , 0xFF
+  sub r0 , 10          ; '\n'
+  jnz r0 , %other
+  add *0x24 , 1
+  push r0
+  pop *0x24
+%other
+  add r2 , 1
+  mov r0 , r2
+  jmp %byte
+
+%slide
+  ; a window that isn't full was the end of the file
+  mov *0x20 , r1
+  mov *0x14 , r2
+  jlt r1 , r2 , %print
+  add *0x10 , 1
+  push r0
+  pop *0x10
+  push *0x10
+  push *0x18
+  mov 8 , *0x00
+  sys
+  pop *0x20
+  jmp %scan
+
+%print
+  ; digits go on the stack backwards, then get printed from the top
+  mov *0x24 , r2
+  mov 0 , *0x28
+%digit
+  divmod r2 , 10
+  mov r0 , r2
+  add r1 , '0'
+  push r0
+  add *0x28 , 1
+  push r0
+  pop *0x28
+  jnz r2 , %digit
+%out
+  pop *0x30
+  pushb *0x30
+  mov 0 , *0x00
+  sys
+  mov *0x28 , r1
+  sub r1 , 1
+  push r0
+  pop *0x28
+  jnz r0 , %out
+  mov 10 , *0x30
+  pushb *0x30
+  mov 0 , *0x00
+  sys
+  hlt
+
+%failed
+  mov '?' , *0x30
+  pushb *0x30
+  mov 0 , *0x00
+  sys
+  hlt
\ No newline at end of file
@@ -0,0 +1,27 @@
+; call frame in the default 16 bit mode, the stack grows up:
+;   [rbp-6] <- argument pushed by the caller
+;   [rbp-4] <- return address pushed by call
+;   [rbp-2] <- caller's rbp pushed by enter
+;   [rbp+0] <- first local, reserved by enter
+jmp %entry
+
+%next
+  ; push rbp, mov rsp to rbp and reserve 2 bytes for a local
+  enter 2
+
+  ; local = argument + 1
+  add [rbp-6] , 1
+  mov r0 , [rbp+0]
+
+  ; return the local in r1
+  mov [rbp+0] , r1
+
+  leave
+  ret
+%entry
+  mov 0x100 , rsp
+  mov 'a' , *0x10
+  push *0x10
+  call %next
+  pop *0x10
+  hlt
\ No newline at end of file
@@ -0,0 +1,74 @@
+; the heap the host keeps for the program, run it with the counters on:
+;   ptr --heap-stats heap.ptr
+mov 0x100 , rsp
+
+; the heap goes over 0x1000 to 0x2000
+mov 0x1000 , *0x10
+mov 0x1000 , *0x14
+push *0x14
+push *0x10
+mov 0x0A , *0x00
+sys
+
+; three blocks of 24 bytes ( they take 32 each ), at *0x20, *0x24 and *0x28
+mov 24 , *0x18
+mov 0x0B , *0x00
+push *0x18
+sys
+pop *0x20
+push *0x18
+sys
+pop *0x24
+push *0x18
+sys
+pop *0x28
+
+; something to find again after the realloc
+mov *0x20 , r2
+mov 'k' , [r2+0]
+
+; freeing the middle one and asking again gives the same block back
+push *0x24
+mov 0x0C , *0x00
+sys
+push *0x18
+mov 0x0B , *0x00
+sys
+pop *0x2C
+mov 0 , *0x00
+jeq *0x24 , *0x2C , %reused
+jmp %bad
+%reused
+
+; growing the first one moves it, with what it held
+mov 200 , *0x18
+push *0x18
+push *0x20
+mov 0x0D , *0x00
+sys
+pop *0x20
+mov 0 , *0x00
+jz *0x20 , %bad
+mov *0x20 , r2
+mov [r2+0] , r0
+and r0 , 0xFF
+sub r0 , 'k'
+jnz r0 , %bad
+
+; *0x00 was set to putchar before every check, so all the paths into %bad agree on it
+mov 'o' , *0x30
+pushb *0x30
+sys
+mov 'k' , *0x30
+pushb *0x30
+sys
+mov 10 , *0x30
+pushb *0x30
+sys
+hlt
+
+%bad
+  mov '?' , *0x30
+  pushb *0x30
+  sys
+  hlt
\ No newline at end of file
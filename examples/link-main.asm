@@ -0,0 +1,13 @@
+; two modules linked into one image:
+;   asm2ptr -o link.ptr link-main.asm link-print.asm
+; %print isn't declared here, so it becomes an import the linker
+; finds in link-print.asm
+mov 0x100 , rsp
+
+mov 'h' , *0x20
+call %print
+mov 'i' , *0x20
+call %print
+mov 10 , *0x20
+call %print
+hlt
\ No newline at end of file
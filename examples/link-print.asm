@@ -0,0 +1,8 @@
+; prints the byte at *0x20, other modules can call it
+export %print
+
+%print
+  mov 0 , *0x00
+  pushb *0x20
+  sys
+  ret
\ No newline at end of file
@@ -0,0 +1,16 @@
+; writes over its own return address so `ret` lands in the middle of an
+; instruction, the verifier can't see that coming, so the image runs
+; unchecked and has to trap ( a jump outside of the image ) instead of
+; running the operand bytes as code:
+;   ptr overwrite-return.ptr
+mov 0x10 , rsp
+call %f
+hlt
+
+%f
+mov rsp , r2
+; 0x0F 0xFF is `pop.r 0xFF` when run from 0x0C, a register that doesn't exist
+mov 0xFF0F , *0x20
+; the return address `call` left at 0x10
+mov 0x0C , *0x10
+ret
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "vm.h"
+
+/*
+    Sends the same request to a ptr --serve server a lot of times, all of
+    them before reading any response back, and says how long each one took.
+    Build it with:
+        gcc ./examples/serve-client.c -o ./build/serve-client -I./include/
+    then:
+        ptr --serve /tmp/ptr.sock echo.ptr &
+        serve-client /tmp/ptr.sock 0 hello 10000
+*/
+
+static bool read_all(int fd, void* buf, size_t size) {
+    for(size_t at = 0; at < size;) {
+        ssize_t got = read(fd, (u8*)buf + at, size - at);
+        if(got <= 0)
+            return false;
+        at += got;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 5)
+        return 1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        printf("ERROR: Couldn't connect to %s\n", argv[1]);
+        return 1;
+    }
+
+    u32 input_size = strlen(argv[3]);
+    int requests = atoi(argv[4]);
+    size_t request_size = 2 * sizeof(u32) + input_size;
+    u8* batch = malloc(request_size * requests);
+    for(int i = 0; i < requests; ++i) {
+        u32 header[2] = { atoi(argv[2]), input_size };
+        memcpy(batch + i * request_size, header, sizeof(header));
+        memcpy(batch + i * request_size + sizeof(header), argv[3], input_size);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // the writes happen on their own process so the server never waits on us reading
+    if(!fork()) {
+        write(fd, batch, request_size * requests);
+        _exit(0);
+    }
+
+    static u8 output[0x10000];
+    u32 response[3];
+    for(int i = 0; i < requests; ++i) {
+        if(!read_all(fd, response, sizeof(response)) || response[2] > sizeof(output) ||
+           !read_all(fd, output, response[2])) {
+            printf("ERROR: Connection closed after %d responses\n", i);
+            return 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    printf("status %u at 0x%04X, output: %.*s\n", response[0], response[1], (int)response[2], output);
+    printf("%d requests, %.2f us each\n", requests, us / requests);
+    close(fd);
+    free(batch);
+    return 0;
+}
\ No newline at end of file
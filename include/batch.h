@@ -0,0 +1,48 @@
+#include "vm.h"
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#define BATCH_LANES 16 // instances that run in lockstep, one 256 bit vector of words
+
+/*
+    Lockstep mode, for running the same image over a lot of inputs.
+
+    BATCH_LANES instances share one dispatch loop: their registers and ip
+    are vectors with a lane per instance, and their memory is interleaved
+    byte by byte ( address * BATCH_LANES + lane ), so an instruction with a
+    fixed address reads or writes that address for every lane with a single
+    vector load or store. The loop is built twice, for AVX2 and for plain
+    vectors, and picks one when it starts.
+
+    Every step runs the instruction at the lowest ip of the lanes still
+    going, masked to the lanes that are there, so lanes that take different
+    branches split up and come back together once their paths meet again.
+    Instances that do what lockstep can't ( syscalls other than getchar and
+    putchar ) move to a VM of their own and finish there, on worker threads
+    ( one per CPU ) that take turns running them, so instances can wait on
+    each other through channels.
+
+    Only verified images in 16 bit mode run in lockstep, anything else runs
+    one instance at a time, with the same results. Instances without their
+    own vm_io share stdin and stdout, a character at a time, and once some
+    of them moved to the workers the order their characters come out in
+    depends on timing, give every instance a vm_io when that matters.
+*/
+typedef struct batch_result batch_result;
+
+struct batch_result {
+    u8 trap;        // TrapNone after a hlt
+    word trap_ip;
+    word r[3];
+    word sp;
+    word bp;
+    bool lockstep;  // false when the instance finished on a VM of its own
+};
+
+// runs `count` instances of the image in `image` ( set up by vm_init and
+// vm_verify, it's only read ), instance i uses ios[i] for getchar and
+// putchar, or stdin/stdout when `ios` is NULL, false when out of memory
+bool batch_run(const vm_t* image, u32 count, vm_io* ios, batch_result* results);
+
+#endif // BATCH_H_
\ No newline at end of file
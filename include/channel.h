@@ -0,0 +1,43 @@
+#include "vm.h"
+
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#define CHANNEL_MAX      0x100   // channel ids go from 0x00 to 0xFF
+#define CHANNEL_MSG_SIZE 0x100   // max bytes carried by a single message
+#define CHANNEL_CAPACITY 0x10000 // max messages a channel holds, bigger asks get this
+#define CHANNEL_WAIT_COST 0x400  // instructions of budget a wait spends, about what a yield costs
+
+/*
+    Channels are host side message queues shared by every VM in the process,
+    they are bounded lock-free ring buffers ( Vyukov style ), with any amount
+    of senders and a single receiver per channel ( MPSC, SPSC is just the case
+    with one sender ). The first VM that receives from a channel is its
+    receiver, any other VM that tries to receive from it traps, until the
+    receiver is destroyed or reset.
+*/
+typedef struct channel channel;
+
+// returns the channel with that id, creating it with room for `capacity`
+// messages ( rounded up to a power of 2 ) if nobody created it before,
+// NULL when the id is out of range or there's no memory for it
+channel* channel_open(word id, word capacity);
+channel* channel_get(word id);
+
+// makes `receiver` the only one allowed to receive from the channel,
+// false when another one already is
+bool channel_claim(channel* ch, const void* receiver);
+// gives up every channel `receiver` claimed
+void channel_release(const void* receiver);
+
+// both return false instead of blocking when the channel is full/empty
+bool channel_try_send(channel* ch, const u8* buf, word size);
+bool channel_try_recv(channel* ch, u8* buf, word max_size, word* size);
+
+// blocking versions, they yield the worker thread while waiting and every
+// wait spends CHANNEL_WAIT_COST of `budget` ( a vm_t.budget, 0 is no limit ),
+// false when it ran out before there was room/a message
+bool channel_send(channel* ch, const u8* buf, word size, unsigned long long* budget);
+bool channel_recv(channel* ch, u8* buf, word max_size, word* size, unsigned long long* budget);
+
+#endif // CHANNEL_H_
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "vm.h"
+
+#ifndef HEAP_H_
+#define HEAP_H_
+
+#define HEAP_GRANULE 0x10                       // smallest block, every block is aligned to it
+#define HEAP_CLASSES (8 * sizeof(word) - 3)     // blocks of HEAP_GRANULE << class bytes
+
+/*
+    A heap the host runs for the program over a region of its memory:
+
+        0x0A heap    pops <addr>, <size>
+                     the heap goes over [addr, addr + size), whatever was
+                     allocated before is forgotten
+        0x0B alloc   pops <size>, pushes the address of the block, 0 when
+                     there's no room ( or no heap )
+        0x0C free    pops <addr>, addresses that aren't a live block are ignored
+        0x0D realloc pops <addr>, <size>, pushes the new address like alloc,
+                     the old block stays as it was when it fails
+
+    Blocks come in power of 2 size classes, every class has its own free
+    list and new blocks are cut from the top of the region, so alloc and
+    free cost the same no matter how busy the heap is. Nothing about the
+    heap is stored in VM memory, sizes and free lists live on the host, so
+    the program can't break them by writing past a block.
+*/
+typedef struct heap heap;
+typedef struct heap_stats heap_stats;
+
+struct heap_stats {
+    u32 size;       // bytes in the region
+    u32 top;        // bytes cut from it so far
+    u32 requested;  // bytes asked for by live blocks
+    u32 in_use;     // bytes of live blocks, in_use - requested is lost to rounding
+    u32 peak;       // highest in_use
+    u32 free;       // bytes waiting in the free lists, cut but not in use
+    u32 allocs;
+    u32 frees;
+    u32 failed;     // allocs that returned 0
+};
+
+bool heap_init(vm_t* vm, word addr, word size);
+// vm_destroy calls it
+void heap_release(vm_t* vm);
+
+word heap_alloc(vm_t* vm, word size);
+void heap_free(vm_t* vm, word addr);
+word heap_realloc(vm_t* vm, word addr, word size);
+
+// false when the program never made a heap
+bool heap_get_stats(vm_t* vm, heap_stats* stats);
+
+#endif // HEAP_H_
\ No newline at end of file
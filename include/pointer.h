@@ -0,0 +1,103 @@
+#include "vm.h"
+#include "heap.h"
+#include "batch.h"
+
+#ifndef POINTER_H_
+#define POINTER_H_
+
+/*
+    libpointer, the assembler and the VM as a library ( asm2ptr and ptr are
+    just small programs on top of it ).
+
+    Nothing in here keeps global state, other than the channel table which
+    VMs share on purpose, so different threads can assemble and run programs
+    at the same time, as long as every VM is only used by one thread at a time.
+*/
+
+#define POINTER_IMAGE_SIZE 0xFFFF // size of vm_t.data
+
+// assembles `source_size` bytes of `source` ( no null terminator needed ) into
+// `image`, which has to hold POINTER_IMAGE_SIZE bytes, `image_size` gets how
+// many of them the program uses ( it can be NULL ).
+// On an error returns false and leaves a message in `error`
+bool pointer_assemble(const char* source, size_t source_size, u8* image, u32* image_size,
+    char* error, size_t error_size);
+
+/*
+    Objects are assembled code that still has to be linked, with the labels it
+    exports, the labels it imports from other objects and the places in the
+    code that hold a label's address ( relocations ).
+    The linker puts objects one after the other in the order it gets them, so
+    the first one is where execution starts.
+*/
+#define POINTER_OBJECT_MAGIC   "PTRO"
+#define POINTER_OBJECT_VERSION 2    // bump when the assembler output changes
+
+enum pointer_reloc_type {
+    RelocLocal,     // a label of the same object, gets the object's address added
+    RelocImport,    // a label exported by another object
+};
+
+typedef struct pointer_symbol pointer_symbol;
+typedef struct pointer_reloc pointer_reloc;
+typedef struct pointer_object pointer_object;
+
+struct pointer_symbol {
+    char* name;     // without the %
+    bool exported;  // false for imports
+    word addr;      // inside of the object, exports only
+};
+
+struct pointer_reloc {
+    u8 type;
+    u32 offset;     // of the word to patch, inside of the object's code
+    u32 symbol;     // index into the object's symbols, RelocImport only
+};
+
+struct pointer_object {
+    u8* code;
+    u32 code_size;
+    pointer_symbol* symbols;
+    u32 symbols_size;
+    pointer_reloc* relocs;
+    u32 relocs_size;
+};
+
+// like pointer_assemble, but labels that aren't in `source` become imports
+bool pointer_assemble_object(const char* source, size_t source_size, pointer_object* object,
+    char* error, size_t error_size);
+void pointer_object_free(pointer_object* object);
+
+// object files, `error` says what was wrong with the file
+bool pointer_object_save(const pointer_object* object, const char* path);
+bool pointer_object_load(pointer_object* object, const char* path, char* error, size_t error_size);
+
+// links `objects_size` objects into `image` ( POINTER_IMAGE_SIZE bytes )
+bool pointer_link(const pointer_object* objects, u32 objects_size, u8* image, u32* image_size,
+    char* error, size_t error_size);
+
+// a new VM with `image` loaded and verified, NULL when out of memory
+vm_t* pointer_create(const u8* image, u32 image_size);
+void pointer_destroy(vm_t* vm);
+
+// host file the program maps as file `index` with syscalls 0x07 to 0x09
+// ( see window.h ), false when it can't be opened
+bool pointer_attach_file(vm_t* vm, u8 index, const char* path, bool writable);
+
+// counters of the heap the program set up ( see heap.h ), false when it didn't
+bool pointer_heap_stats(vm_t* vm, heap_stats* stats);
+
+// runs until a hlt or a trap, returns the trap ( TrapNone after a hlt )
+u8 pointer_run(vm_t* vm);
+
+// runs `count` instances of the image in `vm` side by side ( see batch.h ),
+// instance i reads and writes ios[i], or stdin/stdout when `ios` is NULL
+bool pointer_run_batch(vm_t* vm, u32 count, vm_io* ios, batch_result* results);
+
+// results, registers go in the same order as the register operands
+// ( r0, r1, r2, rsp, rbp ), memory reads and writes out of range return false
+word pointer_register(vm_t* vm, u8 index);
+bool pointer_read(vm_t* vm, word addr, void* out, size_t size);
+bool pointer_write(vm_t* vm, word addr, const void* in, size_t size);
+
+#endif // POINTER_H_
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "vm.h"
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#define SERVER_MAX_INPUT (1 << 24) // bigger requests close the connection
+#define SERVER_BAD_IMAGE 0xFF      // status of a request for an image that isn't loaded
+#define SERVER_BUDGET    (1ull << 30) // instructions a request gets when there's no --budget
+
+/*
+    Server mode ( ptr --serve ), runs the loaded images on request over a
+    unix domain socket, every field is a u32 in host byte order:
+
+        request:  image index, input size, then the input bytes
+        response: status ( the trap, TrapNone after a hlt ), trap ip,
+                  output size, then the output bytes
+
+    Input is what getchar reads ( 0xFF once it runs out ) and output is
+    everything putchar wrote. Every image has a pool of VMs that already
+    have it loaded and verified, a request takes one, runs it and gives it
+    back reset for the next one.
+    Clients can send as many requests as they want without waiting, the
+    responses come back in the same order, and get written out in batches
+    when there is nothing left to run. A request that runs out of its
+    instruction budget stops with TrapBudget, so a program that never
+    stops doesn't keep its VM ( or its connection ) forever.
+*/
+
+// `images` are VMs with the images loaded and verified, they are only
+// copied from, `warm` VMs per image get made up front ( more get made when
+// they are all busy ), every request gets `budget` instructions, it only
+// returns when the socket can't be set up
+bool server_run(const char* socket_path, const vm_t* images, int images_size, int warm,
+    unsigned long long budget);
+
+#endif // SERVER_H_
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "vm.h"
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#define TRACE_MAGIC      "PTRT"
+#define TRACE_REGS       5                  // r0, r1, r2, sp, bp
+#define TRACE_OPERANDS   (VM_MAX_OP_SIZE - 1) // biggest operand list of any instruction
+
+/*
+    Trace file layout:
+        "PTRT", u8 sizeof(word)
+        then one record per executed instruction:
+            word ip, u8 op, the operand bytes ( vm_op_sizes[op] - 1 of them ),
+            u8 mask of the registers that changed, and the new value of each
+            one of them ( a word each, in r0, r1, r2, sp, bp order )
+
+    The VM only copies its registers into a lock-free ring buffer, a background
+    thread encodes the records and writes them to the file, the VM only waits
+    when the writer falls a full ring behind.
+*/
+typedef struct trace trace;
+
+trace* trace_start(const char* path);
+// waits until every record is on the file
+void trace_stop(trace* t);
+
+// the registers execute_vm starts from, before the first trace_record
+void trace_begin(trace* t, vm_t* vm);
+// after the instruction at `ip` ran
+void trace_record(trace* t, vm_t* vm, word ip);
+
+#endif // TRACE_H_
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 #ifndef VM_H_
 #define VM_H_
@@ -9,6 +12,25 @@
 
 #define u8  unsigned char
 #define u16 unsigned short
+#define u32 unsigned int
+
+// #define POINTER_WIDE
+
+// addresses and registers are a `word` wide, 16 bits by default, 32 bits
+// in wide mode ( asm2ptr and ptr have to be built with the same mode )
+#ifdef POINTER_WIDE
+#define word u32
+#define sword int   // signed word, for signed compares
+#define VM_MEMORY_SIZE 0x100000000ull
+#else
+#define word u16
+#define sword short
+#define VM_MEMORY_SIZE 0x10000
+#endif
+
+#define VM_STACK_SIZE   0x400                   // the stack goes from 0x00 to VM_STACK_SIZE
+#define VM_REGISTERS    5                       // r0, r1, r2, rsp, rbp
+#define VM_MAX_OP_SIZE  (1 + 4 * sizeof(word))  // biggest instruction, opcode included
 
 #define todo(msg) \
     do { \
@@ -16,25 +38,60 @@
         exit(1); \
     } while(0)
 
+// the Windows C runtime has no aligned_alloc, and what _aligned_malloc
+// gives back has to go to _aligned_free
+#ifdef _WIN32
+#define vm_aligned_alloc(alignment, size) _aligned_malloc(size, alignment)
+#define vm_aligned_free(ptr)              _aligned_free(ptr)
+#else
+#define vm_aligned_alloc(alignment, size) aligned_alloc(alignment, size)
+#define vm_aligned_free(ptr)              free(ptr)
+#endif
+
 typedef struct vm_t vm_t;
 
 typedef void(* ExternalFunc)(vm_t*);
 
-// 16 bit machine
+// 16 bit machine ( or 32 bit in wide mode )
 struct vm_t{
     /*
-        ROM layout:
-        0x00 to 0x400 -> the stack
+        RAM layout:
+        0x00 to VM_STACK_SIZE -> the stack
 
     */
     u8 data[0xFFFF];
-    u8 memory[0xFFFF];
+    u8 starts[0x10000 / 8]; // a bit per byte of data, set by vm_verify where an instruction starts
+    u8* memory;     // VM_MEMORY_SIZE bytes, allocated by vm_init
     ExternalFunc external[0xFF];
-    u16 r[3];       // general registers ( r0, r1, r2 )
-    u16 sp;         // stack pointer
-    u16 bp;         // base pointer
-    u16 ip;         // relative address pointer for the instructions
+    word r[3];      // general registers ( r0, r1, r2 )
+    word sp;        // stack pointer
+    word bp;        // base pointer
+    word ip;        // relative address pointer for the instructions
     bool halted;
+    bool verified;  // set by vm_verify, runs the interpreter without runtime checks
+    u8 trap;        // why the VM stopped, TrapNone when it reached a hlt
+    word trap_ip;   // instruction that caused the trap
+    word op_ip;     // instruction the checked interpreter is running
+    word scratch;   // bad accesses land here once the VM trapped
+    struct trace* trace; // when set, every executed instruction gets recorded ( see trace.h )
+    struct windows* windows; // host files the program can map into memory ( see window.h )
+    struct heap* heap;       // set up by the program with syscall 0x0A ( see heap.h )
+    struct vm_io* io;        // when set, getchar and putchar use it instead of stdin/stdout
+    unsigned long long budget; // instructions left, TrapBudget when the next one has none ( 0 to begin with is no limit )
+};
+
+enum traps {
+    TrapNone,
+    TrapBadOpcode,
+    TrapBadRegister,
+    TrapBadJump,        // ip left the image
+    TrapMemory,         // memory access past VM_MEMORY_SIZE
+    TrapStackOverflow,  // push past VM_STACK_SIZE
+    TrapStackUnderflow, // pop below 0
+    TrapBadExternal,    // syscall 0x02 to an external that isn't set
+    TrapDivideByZero,
+    TrapChannelReceiver, // receive from a channel another VM receives from
+    TrapBudget,         // ran every instruction vm_t.budget allowed ( a channel wait that runs out stops on its sys )
 };
 
 enum operations {
@@ -70,23 +127,169 @@ enum operations {
     OpReturn,
     OpCall,
     OpLeave,
+
+    // frame operands are a register plus a signed offset, like [rbp-4]
+    OpEnter,     // push rbp, rbp = rsp, rsp += size
+    OpMoveCF,    // move constant to frame
+    OpMoveFR,    // move frame to register
+    OpMoveRF,    // move register to frame
+    OpAddFC,     // r0 = *frame + const
+    OpPushFrame,
+    OpPopFrame,
+
+    // conditional branches, the last operand is where to jump ( unsigned compares )
+    OpJz,        // jump if *addr == 0
+    OpJnz,       // jump if *addr != 0
+    OpJzR,       // jump if reg == 0
+    OpJnzR,      // jump if reg != 0
+    OpJeqAA,     // jump if *addr1 == *addr2
+    OpJltAA,     // jump if *addr1 <  *addr2
+    OpJgtAA,     // jump if *addr1 >  *addr2
+    OpJeqRR,     // jump if reg1 == reg2
+    OpJltRR,     // jump if reg1 <  reg2
+    OpJgtRR,     // jump if reg1 >  reg2
+
+    // r0 = A <op> B, in enum alu_ops order and three forms each:
+    //   RR -> A and B registers, RC -> A register and B constant, AA -> both *addr
+    OpSubRR, OpSubRC, OpSubAA,
+    OpMulRR, OpMulRC, OpMulAA,
+    OpAndRR, OpAndRC, OpAndAA,
+    OpOrRR,  OpOrRC,  OpOrAA,
+    OpXorRR, OpXorRC, OpXorAA,
+    OpShlRR, OpShlRC, OpShlAA,
+    OpShrRR, OpShrRC, OpShrAA,
+    OpLtRR,  OpLtRC,  OpLtAA,   // unsigned, like jlt
+    OpLtsRR, OpLtsRC, OpLtsAA,  // signed
+    OpAddRR,     // r0 = reg1 + reg2, the form add was missing
+    OpDivRR, OpDivRC, OpDivAA,  // r0 = A / B, r1 = A % B, traps when B is 0
+    OpNotR,      // r0 = ~reg
+    OpNotA,      // r0 = ~*addr
+
+    OpCount,
 };
 
+enum alu_ops {
+    AluSub,
+    AluMul,
+    AluAnd,
+    AluOr,
+    AluXor,
+    AluShl,
+    AluShr,
+    AluLt,
+    AluLts,
+};
+
+// OpSubRR up to OpLtsAA, which alu op and which form ( 0 RR, 1 RC, 2 AA )
+#define VM_ALU_OP(op)   (((op) - OpSubRR) / 3)
+#define VM_ALU_FORM(op) (((op) - OpSubRR) % 3)
+
+// shared by the interpreter and ptr2c, so both agree on every corner case
+// ( shifting by the word size or more gives 0 instead of undefined behaviour )
+static inline word vm_alu(u8 alu, word a, word b) {
+    switch(alu) {
+        case AluSub: return a - b;
+        case AluMul: return (u32)a * (u32)b;
+        case AluAnd: return a & b;
+        case AluOr:  return a | b;
+        case AluXor: return a ^ b;
+        case AluShl: return b >= 8 * sizeof(word) ? 0 : (word)((u32)a << b);
+        case AluShr: return b >= 8 * sizeof(word) ? 0 : a >> b;
+        case AluLt:  return a < b;
+        case AluLts: return (sword)a < (sword)b;
+    }
+    return 0;
+}
+
+extern const u8 vm_op_sizes[OpCount];
+extern const char* vm_op_names[OpCount];
+// operand kinds of every instruction, one character each:
+//   c -> constant word      a -> address word      t -> jump target word
+//   r -> register byte      f -> frame ( register byte + offset word )
+extern const char* vm_op_operands[OpCount];
+extern const char* vm_trap_names[];
+extern const size_t vm_register_offsets[VM_REGISTERS];
+
+#define VM_REGISTER(vm, index) ((word*)((u8*)(vm) + vm_register_offsets[index]))
+// whether `ip` is where vm_verify found an instruction
+#define VM_IS_START(vm, ip) ((ip) < sizeof((vm)->data) && (vm)->starts[(ip) >> 3] >> ((ip) & 7) & 1)
+
 #ifdef POINTER_DEBUG
-void vm_dump_memory(vm_t* vm, u16 max_memory_index);
+void vm_dump_memory(vm_t* vm, word max_memory_index);
 #endif
 
-u16* vm_get_register(vm_t* vm, u8 index);
+// reserves the VM memory, pages are only backed by real memory once touched
+bool vm_init(vm_t* vm);
+void vm_destroy(vm_t* vm);
+
+// back to how vm_init left it, with the image still loaded ( and verified ),
+// so the same VM can run the program again without loading it
+void vm_reset(vm_t* vm);
+
+typedef struct vm_io vm_io;
+
+// input and output of a VM that isn't on the terminal ( see vm_t.io )
+struct vm_io {
+    const u8* in;       // getchar reads from here, and gets 0xFF once it's all read
+    u32 in_size;
+    u32 in_at;
+    u8* out;            // putchar appends here, growing it up to VM_IO_MAX_OUT bytes
+    u32 out_size;
+    u32 out_capacity;
+};
+
+#define VM_IO_MAX_OUT (1 << 24) // past this much output putchar drops the bytes
+
+// what getchar and putchar do for a VM with `io`, stdin and stdout when it's NULL
+u8 vm_io_get(vm_io* io);
+void vm_io_put(vm_io* io, u8 c);
+
+// stops the VM, the first trap is the one that gets reported
+void vm_trap(vm_t* vm, u8 trap);
+
+typedef struct vm_verify_report vm_verify_report;
+
+struct vm_verify_report {
+    bool code_ok;           // opcodes, registers, memory operands and targets
+    bool stack_bounded;     // rsp proven to stay inside of the stack
+    word stack_max;         // highest rsp the program can reach
+    const char* error;      // first thing that couldn't be proven, NULL if none
+    word error_ip;
+};
+
+// checks opcodes, registers, jump targets, memory operands and the maximum
+// stack depth of the image in vm->data, when everything is proven fine
+// it sets vm->verified so the image runs without runtime checks
+// ( `report` can be NULL )
+bool vm_verify(vm_t* vm, vm_verify_report* report);
+
+// an unknown index traps
+word* vm_get_register(vm_t* vm, u8 index);
 
 u8 vm_popU8_stack(vm_t* vm);
 void vm_pushU8_stack(vm_t* vm, u8 num);
-u16 vm_popU16_stack(vm_t* vm);
-void vm_pushU16_stack(vm_t* vm, u16 num);
+word vm_popWord_stack(vm_t* vm);
+void vm_pushWord_stack(vm_t* vm, word num);
 
-u16 vm_read_u16(vm_t* vm);
+word vm_read_word(vm_t* vm);
 
 void vm_skip_instruction(vm_t* vm);
 
+void vm_syscall(vm_t* vm);
+
+// how each syscall moves the stack, for the tools that reason about programs
+typedef struct vm_syscall_effect vm_syscall_effect;
+
+struct vm_syscall_effect {
+    u8 pops;            // bytes
+    u8 pushes;
+    bool writes_memory; // somewhere that isn't known until it runs
+    bool unknown;       // can do anything ( external functions )
+};
+
+#define VM_SYSCALLS 0x0E
+extern const vm_syscall_effect vm_syscall_effects[VM_SYSCALLS];
+
 void execute_vm(vm_t* vm);
 
 #endif // VM_H_
\ No newline at end of file
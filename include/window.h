@@ -0,0 +1,47 @@
+#include "vm.h"
+
+#ifndef WINDOW_H_
+#define WINDOW_H_
+
+#define WINDOW_FILES 0x10   // host files a VM can have attached at once
+#define WINDOW_MAX   0x10   // windows a VM can have mapped at once
+#define WINDOW_PAGE  0x1000 // windows start and slide in pages of this size
+
+/*
+    Windows map part of a host file straight into VM memory, the host
+    attaches the files ( by index ) and the program maps them with syscalls:
+
+        0x07 map   pops <file>, <addr>, <size>, <page>
+                   maps `size` bytes of the file starting at page `page`
+                   into memory at `addr`, pushes how many of those bytes
+                   are in the file ( less than `size` near the end )
+        0x08 slide pops <addr>, <page>
+                   moves the window at `addr` to another page of its file,
+                   pushes the bytes in the file like map
+        0x09 unmap pops <addr>
+                   the window goes back to plain zeroed memory
+
+    Every one of them pushes ( or gets ignored with ) (word)-1 on bad
+    arguments, `addr` has to be page aligned and windows can't overlap the
+    stack or each other.
+
+    Windows are mmap'd over the VM memory with MAP_FIXED, so there are no
+    copies, writable files are shared with the file, read only ones are
+    private copy on write pages ( the VM can scribble on them, the file
+    never changes ). The part of the window past the end of the file stays
+    zeroed memory, files shouldn't shrink while they are mapped.
+    Where that can't be done ( windows, hosts with other page sizes ) the
+    window is read in and written back on slide/unmap instead.
+*/
+typedef struct windows windows;
+
+// the file the program knows as `index`, replacing whatever was there
+bool window_attach(vm_t* vm, u8 index, const char* path, bool writable);
+// writes back and closes everything, vm_destroy calls it
+void window_release(vm_t* vm);
+
+word window_map(vm_t* vm, word file, word addr, word size, word page);
+word window_slide(vm_t* vm, word addr, word page);
+void window_unmap(vm_t* vm, word addr);
+
+#endif // WINDOW_H_
\ No newline at end of file
@@ -0,0 +1,1194 @@
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <setjmp.h>
+
+#include "pointer.h"
+
+/*
+    The assembler, everything it needs lives in an `assembler` on the stack of
+    pointer_assemble, so any number of threads can assemble at the same time.
+    Errors longjmp back to pointer_assemble, which frees whatever was allocated.
+
+    Labels are local to the file, `export %<id>` makes one visible to other
+    objects, and when assembling an object every label that isn't declared
+    in the file becomes an import the linker has to find ( see object.c ).
+
+    Routines ( a label, straight code, a ret ) up to ASM_INLINE_MAX
+    instructions, or marked with `inline %<id>`, replace the calls to them.
+    That takes a second pass: the first one finds where every instruction
+    starts, the second one emits the code with the calls inlined.
+*/
+
+#define ASM_INLINE_MAX   4   // routines up to this many instructions get inlined on their own
+#define ASM_INLINE_DEPTH 8   // inlined routines calling inlined routines, at most this deep
+
+typedef struct token token;
+typedef struct patch patch;
+typedef struct instruction instruction;
+typedef struct routine routine;
+typedef struct assembler assembler;
+
+enum token_type {
+    TokenEq,   // eq <Cptr>, <Aptr>, <Bptr>
+    TokenAdd,  // add <Cptr>, <Aptr>, <Bptr>
+    TokenMov,  // mov <value>, <addr>
+    TokenNull, // null <addr> => mov 0, <addr>
+    TokenPush, // push <addr>
+    TokenPushB,// pushb <addr>
+    TokenPop,  // pop <addr>
+    TokenPopB, // popb <addr>
+    TokenJmp,  // jmp <addr>
+    TokenIf,   // if <addr>
+    TokenJz,   // jz <addr|reg>, <target>
+    TokenJnz,  // jnz <addr|reg>, <target>
+    TokenJeq,  // jeq <A>, <B>, <target> ( both addresses or both registers )
+    TokenJlt,  // jlt <A>, <B>, <target>
+    TokenJgt,  // jgt <A>, <B>, <target>
+    TokenCall, // call <addr>
+    TokenHalt, // halt
+    TokenSys,  // sys
+    TokenRet,  // ret
+    TokenLeave, // leave
+    TokenEnter, // enter <size>
+    TokenExport, // export %<id>
+    TokenInline, // inline %<id>
+    TokenAlu,    // sub, mul, and, or, xor, shl, shr, lt, lts <A>, <B> ( data is the alu op )
+    TokenDivmod, // divmod <A>, <B>
+    TokenNot,    // not <reg|addr>
+    TokenNumber,
+    TokenComma,
+    TokenAddress,
+    TokenSymbol, // $<id>
+    TokenRegister, // rsi, rbp, r0, r1, r2
+    TokenFrame,    // [<register>+<offset>]
+    TokenEOF,
+};
+
+static const char* token_names[] = {
+    [TokenEq] = "eq", [TokenAdd] = "add", [TokenMov] = "mov", [TokenNull] = "null",
+    [TokenPush] = "push", [TokenPushB] = "pushb", [TokenPop] = "pop", [TokenPopB] = "popb",
+    [TokenJmp] = "jmp", [TokenIf] = "if", [TokenJz] = "jz", [TokenJnz] = "jnz",
+    [TokenJeq] = "jeq", [TokenJlt] = "jlt", [TokenJgt] = "jgt", [TokenCall] = "call",
+    [TokenHalt] = "hlt", [TokenSys] = "sys", [TokenRet] = "ret", [TokenLeave] = "leave",
+    [TokenEnter] = "enter", [TokenExport] = "export",
+    [TokenInline] = "inline", [TokenAlu] = "an alu instruction", [TokenDivmod] = "divmod",
+    [TokenNot] = "not", [TokenNumber] = "a number", [TokenComma] = "','",
+    [TokenAddress] = "an address", [TokenSymbol] = "a label", [TokenRegister] = "a register",
+    [TokenFrame] = "a frame operand", [TokenEOF] = "the end of the file",
+};
+
+static const char* alu_names[] = {
+    [AluSub] = "sub", [AluMul] = "mul", [AluAnd] = "and", [AluOr] = "or", [AluXor] = "xor",
+    [AluShl] = "shl", [AluShr] = "shr", [AluLt] = "lt", [AluLts] = "lts",
+};
+
+struct token {
+    u8 type;
+    u8 base; // register of a TokenFrame, the offset goes in data
+    u32 at;  // offset in the source, for errors
+    union {
+        word data;
+        char* symbol;
+    };
+};
+
+enum patch_type {
+    PATCH_DECL, // when we find `$<id>` alone, we know is a declaration
+    PATCH_REF,  // when we find `$<id>` in a instruction like `jmp $<id>`, we know is a reference
+    PATCH_EXPORT, // `export %<id>`, other objects can use it once linked
+};
+
+struct patch {
+    u8 type;
+    word addr;
+    char* id;
+    u32 at;
+};
+
+// the tokens that make up one instruction ( or label, or directive )
+struct instruction {
+    u8 type;        // of its first token
+    u32 start;      // first token
+    u32 end;        // one past the last token
+};
+
+// `%label` followed by straight code up to a `ret`, a candidate for inlining
+struct routine {
+    char* name;
+    u32 first;      // instructions of the body, without enter/leave and ret
+    u32 last;
+    const char* problem; // why it can't be inlined, NULL if it can
+    bool inlined;   // every `call` to it gets the body instead
+    bool expanding; // being inlined right now, stops recursion
+};
+
+struct assembler {
+    char* source;   // null terminated copy of the source
+    size_t source_size;
+
+    token* tokens;
+    u32 tokens_size;
+    u32 tokens_capacity;
+    u32 next;       // next token gen_bytecode looks at
+
+    patch* patches;
+    u32 patches_size;
+    u32 patches_capacity;
+
+    u8* image;
+    u32 ip;
+
+    u32 symbols_capacity;   // of the object being built, if any
+    u32 relocs_capacity;
+
+    // filled by the first pass, to find routines worth inlining
+    instruction* instructions;
+    u32 instructions_size;
+    u32 instructions_capacity;
+    bool numeric_targets;   // some jump or call goes to a number, so code can't move
+    bool lowered;           // the pass turned some `if` + `jmp` into a `jz`
+
+    routine* routines;
+    u32 routines_size;
+    u32 routines_capacity;
+    u32 inline_depth;
+    u32 if_end;             // ip right after the last `if`, what starts there is all it skips
+
+    char* error;
+    size_t error_size;
+    jmp_buf fail;
+};
+
+static void asm_error(assembler* a, u32 at, const char* fmt, ...) {
+    u32 line = 1;
+    for(u32 i = 0; i < at && i < a->source_size; ++i)
+        line += a->source[i] == '\n';
+
+    if(a->error_size) {
+        int size = snprintf(a->error, a->error_size, "line %u: ", line);
+        if(size >= 0 && (size_t)size < a->error_size) {
+            va_list args;
+            va_start(args, fmt);
+            vsnprintf(a->error + size, a->error_size - size, fmt, args);
+            va_end(args);
+        }
+    }
+    longjmp(a->fail, 1);
+}
+
+static void* asm_grow(assembler* a, void* array, u32* capacity, size_t item_size) {
+    u32 new_capacity = *capacity ? *capacity * 2 : 64;
+    void* grown = realloc(array, new_capacity * item_size);
+    if(!grown)
+        asm_error(a, 0, "out of memory");
+    *capacity = new_capacity;
+    return grown;
+}
+
+// strndup isn't in the Windows C runtime
+static char* asm_strndup(const char* str, size_t size) {
+    char* copy = malloc(size + 1);
+    if(!copy)
+        return NULL;
+    memcpy(copy, str, size);
+    copy[size] = '\0';
+    return copy;
+}
+
+static void push_token(assembler* a, token t) {
+    if(a->tokens_size == a->tokens_capacity)
+        a->tokens = asm_grow(a, a->tokens, &a->tokens_capacity, sizeof(token));
+    a->tokens[a->tokens_size++] = t;
+}
+
+static void patches_push(assembler* a, u8 type, word addr, char* id, u32 at) {
+    if(a->patches_size == a->patches_capacity)
+        a->patches = asm_grow(a, a->patches, &a->patches_capacity, sizeof(patch));
+    a->patches[a->patches_size++] = (patch) {
+        .type = type,
+        .addr = addr,
+        .id = id,
+        .at = at
+    };
+}
+
+static int register_index(const char* name) {
+    if(!strcmp(name, "r0"))
+        return 0x00;
+    if(!strcmp(name, "r1"))
+        return 0x01;
+    if(!strcmp(name, "r2"))
+        return 0x02;
+    if(!strcmp(name, "rsp"))
+        return 0x03;
+    if(!strcmp(name, "rbp"))
+        return 0x04;
+    return -1;
+}
+
+static int alu_index(const char* name) {
+    for(u32 i = 0; i < sizeof(alu_names)/sizeof(*alu_names); ++i)
+        if(!strcmp(name, alu_names[i]))
+            return i;
+    return -1;
+}
+
+static void lex(assembler* a) {
+    const char* src = a->source;
+    size_t size = a->source_size;
+    char lexeme[256];
+    u8 li = 0;
+
+    bool isPointer = false;
+    size_t i = 0;
+    while(i < size) {
+        char c = src[i];
+        u32 at = i;
+        if(isspace((u8)c)) {
+            ++i;
+            continue;
+        }
+        if(isPointer && !isdigit((u8)c))
+            asm_error(a, at, "expected an address after '*'");
+
+        switch(c) {
+            case ';':
+                while(i < size && src[i] != '\n')
+                    ++i;
+            break;
+            case '\'': {
+                if(i + 2 >= size || src[i+2] != '\'')
+                    asm_error(a, at, "a character literal holds exactly one character");
+                push_token(a, (token) {
+                    .type = TokenNumber,
+                    .at = at,
+                    .data = (u8)src[i+1]
+                });
+                i += 3;
+            } break;
+            case ',':
+                push_token(a, (token) {
+                    .type = TokenComma,
+                    .at = at
+                });
+                ++i;
+            break;
+            case '*':
+                isPointer = true;
+                ++i;
+            break;
+            // [<register>], [<register>+<offset>] or [<register>-<offset>]
+            case '[': {
+                ++i;
+                li = 0;
+                while(i < size && isspace((u8)src[i]))
+                    ++i;
+                while(i < size && isalnum((u8)src[i]) && li < sizeof(lexeme)-1)
+                    lexeme[li++] = src[i++];
+                lexeme[li] = 0;
+
+                int base = register_index(lexeme);
+                if(base < 0)
+                    asm_error(a, at, "unknown register in frame operand ( %s )", lexeme);
+
+                while(i < size && isspace((u8)src[i]))
+                    ++i;
+
+                word offset = 0;
+                if(src[i] == '+' || src[i] == '-') {
+                    bool negative = src[i++] == '-';
+                    while(i < size && isspace((u8)src[i]))
+                        ++i;
+                    if(!isdigit((u8)src[i]))
+                        asm_error(a, at, "expected an offset in frame operand");
+                    char* end;
+                    offset = (word)strtoul(src+i, &end, 0);
+                    i = end - src;
+                    if(negative)
+                        offset = -offset;
+                }
+
+                while(i < size && isspace((u8)src[i]))
+                    ++i;
+                if(src[i] != ']')
+                    asm_error(a, at, "expected ']' to close the frame operand");
+                ++i;
+
+                push_token(a, (token) {
+                    .type = TokenFrame,
+                    .at = at,
+                    .base = base,
+                    .data = offset
+                });
+            } break;
+            case '%': {
+                ++i;
+                size_t start = i;
+                while(i < size && (isalnum((u8)src[i]) || src[i] == '_'))
+                    ++i;
+                if(i == start)
+                    asm_error(a, at, "expected a label name after '%%'");
+
+                char* symbol = asm_strndup(src+start, i-start);
+                if(!symbol)
+                    asm_error(a, at, "out of memory");
+                push_token(a, (token) {
+                    .type = TokenSymbol,
+                    .at = at,
+                    .symbol = symbol
+                });
+            } break;
+            default:
+                if(isalpha((u8)c)) {
+                    li = 0;
+                    while(i < size && isalnum((u8)src[i]) && li < sizeof(lexeme)-1)
+                        lexeme[li++] = src[i++];
+                    lexeme[li] = 0;
+
+                    u8 type = 0;
+                    word data = 0;
+
+                    if(!strcmp(lexeme, "mov"))
+                        type = TokenMov;
+                    else if(!strcmp(lexeme, "eq"))
+                        type = TokenEq;
+                    else if(!strcmp(lexeme, "add"))
+                        type = TokenAdd;
+                    else if(!strcmp(lexeme, "null"))
+                        type = TokenNull;
+                    else if(!strcmp(lexeme, "hlt"))
+                        type = TokenHalt;
+                    else if(!strcmp(lexeme, "push"))
+                        type = TokenPush;
+                    else if(!strcmp(lexeme, "pushb"))
+                        type = TokenPushB;
+                    else if(!strcmp(lexeme, "pop"))
+                        type = TokenPop;
+                    else if(!strcmp(lexeme, "popb"))
+                        type = TokenPopB;
+                    else if(!strcmp(lexeme, "jmp"))
+                        type = TokenJmp;
+                    else if(!strcmp(lexeme, "if"))
+                        type = TokenIf;
+                    else if(!strcmp(lexeme, "jz"))
+                        type = TokenJz;
+                    else if(!strcmp(lexeme, "jnz"))
+                        type = TokenJnz;
+                    else if(!strcmp(lexeme, "jeq"))
+                        type = TokenJeq;
+                    else if(!strcmp(lexeme, "jlt"))
+                        type = TokenJlt;
+                    else if(!strcmp(lexeme, "jgt"))
+                        type = TokenJgt;
+                    else if(!strcmp(lexeme, "ret"))
+                        type = TokenRet;
+                    else if(!strcmp(lexeme, "call"))
+                        type = TokenCall;
+                    else if(!strcmp(lexeme, "sys"))
+                        type = TokenSys;
+                    else if(!strcmp(lexeme, "leave"))
+                        type = TokenLeave;
+                    else if(!strcmp(lexeme, "enter"))
+                        type = TokenEnter;
+                    else if(!strcmp(lexeme, "export"))
+                        type = TokenExport;
+                    else if(!strcmp(lexeme, "inline"))
+                        type = TokenInline;
+                    else if(!strcmp(lexeme, "divmod"))
+                        type = TokenDivmod;
+                    else if(!strcmp(lexeme, "not"))
+                        type = TokenNot;
+                    else if(register_index(lexeme) >= 0) {
+                        type = TokenRegister;
+                        data = register_index(lexeme);
+                    }
+                    else if(alu_index(lexeme) >= 0) {
+                        type = TokenAlu;
+                        data = alu_index(lexeme);
+                    }
+                    else
+                        asm_error(a, at, "unknown lexeme ( %s )", lexeme);
+
+                    push_token(a, (token) {
+                        .type = type,
+                        .at = at,
+                        .data = data
+                    });
+                } else if(isdigit((u8)c)) {
+                    // 0x<hex> or <decimal>
+                    char* end;
+                    word data;
+                    if(c == '0' && (src[i+1] == 'x' || src[i+1] == 'X'))
+                        data = (word)strtoul(src+i+2, &end, 16);
+                    else
+                        data = (word)strtoul(src+i, &end, 10);
+                    i = end - src;
+
+                    u8 type = TokenNumber;
+                    if(isPointer) {
+                        isPointer = false;
+                        type = TokenAddress;
+                    }
+
+                    push_token(a, (token) {
+                        .type = type,
+                        .at = at,
+                        .data = data
+                    });
+                } else {
+                    asm_error(a, at, "unexpected character '%c'", c);
+                }
+            break;
+        }
+    }
+    if(isPointer)
+        asm_error(a, size, "expected an address after '*'");
+
+    push_token(a, (token) {
+        .type = TokenEOF,
+        .at = size
+    });
+}
+
+// next token, EOF stays put so running out of operands is just a wrong type
+static token take(assembler* a) {
+    token t = a->tokens[a->next];
+    if(t.type != TokenEOF)
+        ++a->next;
+    return t;
+}
+
+static token take_type(assembler* a, u8 type) {
+    token t = take(a);
+    if(t.type != type)
+        asm_error(a, t.at, "expected %s, found %s", token_names[type], token_names[t.type]);
+    return t;
+}
+
+static void skip_comma(assembler* a) {
+    take_type(a, TokenComma);
+}
+
+static void bad_operands(assembler* a, token op, token x, token y) {
+    const char* name = op.type == TokenAlu ? alu_names[op.data] : token_names[op.type];
+    asm_error(a, op.at, "%s doesn't take %s and %s", name,
+        token_names[x.type], token_names[y.type]);
+}
+
+static void emit_u8(assembler* a, u8 value) {
+    if(a->ip + 1 > POINTER_IMAGE_SIZE)
+        asm_error(a, a->tokens[a->next ? a->next-1 : 0].at, "program doesn't fit in the image");
+    a->image[a->ip++] = value;
+}
+
+static void emit_word(assembler* a, word value) {
+    if(a->ip + sizeof(word) > POINTER_IMAGE_SIZE)
+        asm_error(a, a->tokens[a->next ? a->next-1 : 0].at, "program doesn't fit in the image");
+    memcpy(a->image + a->ip, &value, sizeof(word));
+    a->ip += sizeof(word);
+}
+
+// jump targets are either a number or a `%<id>` patched once all labels are known
+static void emit_target(assembler* a, token t) {
+    switch(t.type) {
+        case TokenNumber:
+            emit_word(a, t.data);
+        break;
+        case TokenSymbol:
+            patches_push(a, PATCH_REF, a->ip, t.symbol, t.at);
+            emit_word(a, 0);
+        break;
+        default:
+            asm_error(a, t.at, "expected a number or a label, found %s", token_names[t.type]);
+        break;
+    }
+}
+
+static void gen_instruction(assembler* a);
+
+static routine* find_routine(assembler* a, const char* name) {
+    for(u32 i = 0; i < a->routines_size; ++i)
+        if(!strcmp(a->routines[i].name, name))
+            return &a->routines[i];
+    return NULL;
+}
+
+// the body goes where the call was, and since it is straight code ending
+// in `ret`, the continuation is just the next instruction
+static void inline_routine(assembler* a, routine* r) {
+    u32 next = a->next;
+    r->expanding = true;
+    ++a->inline_depth;
+    for(u32 i = r->first; i < r->last; ++i) {
+        a->next = a->instructions[i].start;
+        gen_instruction(a);
+    }
+    --a->inline_depth;
+    r->expanding = false;
+    a->next = next;
+}
+
+static void gen_instruction(assembler* a) {
+    token tok = take(a);
+    switch(tok.type) {
+        case TokenSymbol: {
+            patches_push(a, PATCH_DECL, a->ip, tok.symbol, tok.at);
+        } break;
+        case TokenInline: {
+            // marks a routine as always inlined, see find_routines
+            take_type(a, TokenSymbol);
+        } break;
+        case TokenExport: {
+            token t = take_type(a, TokenSymbol);
+            patches_push(a, PATCH_EXPORT, 0, t.symbol, t.at);
+        } break;
+        case TokenLeave:
+            emit_u8(a, OpLeave);
+        break;
+        case TokenEnter: {
+            word size = take_type(a, TokenNumber).data;
+
+            emit_u8(a, OpEnter);
+            emit_word(a, size);
+        } break;
+        case TokenHalt: {
+            emit_u8(a, OpHlt);
+        } break;
+        case TokenSys: {
+            emit_u8(a, OpSyscall);
+        } break;
+
+        /*
+        case TokenEq:{
+            // eq <Cptr>, <Aptr>, <Bptr>
+            word c = tokens[i++].data;
+            tokens[i++]; // Skip the comma
+            word a = tokens[i++].data;
+            tokens[i++]; // Skip the comma
+            word b = tokens[i++].data;
+
+            vm.data[vm.ip++] = OpEq;
+            // Cptr
+            *(word*)(vm.data+vm.ip) = c;
+            vm.ip += sizeof(word);
+            // Aptr
+            *(word*)(vm.data+vm.ip) = a;
+            vm.ip += sizeof(word);
+            // Bptr
+            *(word*)(vm.data+vm.ip) = b;
+            vm.ip += sizeof(word);
+        } break;
+        */
+        case TokenAdd:{
+            token value = take(a);
+            skip_comma(a);
+            token to = take(a);
+
+            if(value.type == TokenAddress && to.type == TokenAddress){
+                emit_u8(a, OpAddAA);
+                emit_word(a, value.data);
+                emit_word(a, to.data);
+            } else if(value.type == TokenAddress && to.type == TokenNumber){
+                emit_u8(a, OpAddAC);
+                emit_word(a, value.data);
+                emit_word(a, to.data);
+            } else if(value.type == TokenRegister && to.type == TokenRegister){
+                emit_u8(a, OpAddRR);
+                emit_u8(a, value.data);
+                emit_u8(a, to.data);
+            } else if(value.type == TokenRegister && to.type == TokenNumber){
+                emit_u8(a, OpAddRC);
+                emit_u8(a, value.data);
+                emit_word(a, to.data);
+            } else if(value.type == TokenFrame && to.type == TokenNumber){
+                emit_u8(a, OpAddFC);
+                emit_u8(a, value.base);
+                emit_word(a, value.data);
+                emit_word(a, to.data);
+            } else {
+                bad_operands(a, tok, value, to);
+            }
+        } break;
+        // the result goes to r0 ( and the remainder of divmod to r1 )
+        case TokenAlu:
+        case TokenDivmod: {
+            token x = take(a);
+            skip_comma(a);
+            token y = take(a);
+
+            // the three forms of every op come one after the other
+            u8 op = tok.type == TokenDivmod ? OpDivRR : OpSubRR + tok.data * 3;
+            if(x.type == TokenRegister && y.type == TokenRegister) {
+                emit_u8(a, op);
+                emit_u8(a, x.data);
+                emit_u8(a, y.data);
+            } else if(x.type == TokenRegister && y.type == TokenNumber) {
+                emit_u8(a, op + 1);
+                emit_u8(a, x.data);
+                emit_word(a, y.data);
+            } else if(x.type == TokenAddress && y.type == TokenAddress) {
+                emit_u8(a, op + 2);
+                emit_word(a, x.data);
+                emit_word(a, y.data);
+            } else {
+                bad_operands(a, tok, x, y);
+            }
+        } break;
+        case TokenNot: {
+            token t = take(a);
+
+            switch(t.type) {
+                case TokenRegister:
+                    emit_u8(a, OpNotR);
+                    emit_u8(a, t.data);
+                break;
+                case TokenAddress:
+                    emit_u8(a, OpNotA);
+                    emit_word(a, t.data);
+                break;
+                default:
+                    asm_error(a, t.at, "not doesn't take %s", token_names[t.type]);
+                break;
+            }
+        } break;
+        case TokenMov: {
+            // mov <value>, <to>
+            token value = take(a);
+            skip_comma(a);
+            token to = take(a);
+
+            if(value.type == TokenNumber && to.type == TokenAddress){
+                emit_u8(a, OpMoveCA);
+                emit_word(a, value.data);
+                emit_word(a, to.data);
+            } else if(value.type == TokenSymbol && to.type == TokenAddress){
+                emit_u8(a, OpMoveCA);
+                emit_target(a, value);
+                emit_word(a, to.data);
+            } else if(value.type == TokenNumber && to.type == TokenRegister){
+                emit_u8(a, OpMoveCR);
+                emit_word(a, value.data);
+                emit_u8(a, to.data);
+            } else if(value.type == TokenRegister && to.type == TokenRegister) {
+                emit_u8(a, OpMoveRR);
+                emit_u8(a, value.data);
+                emit_u8(a, to.data);
+            } else if(value.type == TokenAddress && to.type == TokenRegister) {
+                emit_u8(a, OpMoveAR);
+                emit_word(a, value.data);
+                emit_u8(a, to.data);
+            } else if(value.type == TokenNumber && to.type == TokenFrame) {
+                emit_u8(a, OpMoveCF);
+                emit_word(a, value.data);
+                emit_u8(a, to.base);
+                emit_word(a, to.data);
+            } else if(value.type == TokenFrame && to.type == TokenRegister) {
+                emit_u8(a, OpMoveFR);
+                emit_u8(a, value.base);
+                emit_word(a, value.data);
+                emit_u8(a, to.data);
+            } else if(value.type == TokenRegister && to.type == TokenFrame) {
+                emit_u8(a, OpMoveRF);
+                emit_u8(a, value.data);
+                emit_u8(a, to.base);
+                emit_word(a, to.data);
+            } else {
+                bad_operands(a, tok, value, to);
+            }
+        } break;
+        // TODO: maybe add an extra step between tokens and bytecode
+        // so all this syntax sugar can be converted to that
+        // before we generate the bytecode
+        case TokenNull: {
+            word addr = take_type(a, TokenAddress).data;
+
+            emit_u8(a, OpMoveCA);
+            emit_word(a, 0);    // value
+            emit_word(a, addr); // to
+        } break;
+        case TokenPush: {
+            token t = take(a);
+
+            switch(t.type) {
+                case TokenRegister:
+                    emit_u8(a, OpPushReg);
+                    emit_u8(a, t.data);
+                break;
+                case TokenAddress:
+                    emit_u8(a, OpPushAddr);
+                    emit_word(a, t.data);
+                break;
+                case TokenFrame:
+                    emit_u8(a, OpPushFrame);
+                    emit_u8(a, t.base);
+                    emit_word(a, t.data);
+                break;
+                default:
+                    asm_error(a, t.at, "push doesn't take %s", token_names[t.type]);
+                break;
+            }
+        } break;
+        case TokenPushB: {
+            word addr = take_type(a, TokenAddress).data;
+
+            emit_u8(a, OpPushAddrB);
+            emit_word(a, addr);
+        } break;
+        case TokenPop: {
+            token t = take(a);
+
+            switch(t.type) {
+                case TokenRegister:
+                    emit_u8(a, OpPopReg);
+                    emit_u8(a, t.data);
+                break;
+                case TokenAddress:
+                    emit_u8(a, OpPopAddr);
+                    emit_word(a, t.data);
+                break;
+                case TokenFrame:
+                    emit_u8(a, OpPopFrame);
+                    emit_u8(a, t.base);
+                    emit_word(a, t.data);
+                break;
+                default:
+                    asm_error(a, t.at, "pop doesn't take %s", token_names[t.type]);
+                break;
+            }
+        }break;
+        case TokenPopB:{
+            word addr = take_type(a, TokenAddress).data;
+
+            emit_u8(a, OpPopAddrB);
+            emit_word(a, addr);
+        }break;
+        case TokenJmp:{
+            emit_u8(a, OpJmp);
+            emit_target(a, take(a));
+        }break;
+        case TokenIf:{
+            word addr = take_type(a, TokenAddress).data;
+
+            // `if <addr>` + `jmp <target>` only jumps when *addr is 0,
+            // so turn it into a single `jz` instead of an if + skip ( that
+            // moves code around, so not when something jumps to a number )
+            if(a->tokens[a->next].type == TokenJmp && !a->numeric_targets) {
+                take(a);
+                a->lowered = true;
+                emit_u8(a, OpJz);
+                emit_word(a, addr);
+                emit_target(a, take(a));
+                break;
+            }
+
+            emit_u8(a, OpIf);
+            emit_word(a, addr);
+            a->if_end = a->ip;
+        }break;
+
+        case TokenJz:
+        case TokenJnz:{
+            token value = take(a);
+            skip_comma(a);
+            token target = take(a);
+
+            switch(value.type) {
+                case TokenAddress:
+                    emit_u8(a, tok.type == TokenJz ? OpJz : OpJnz);
+                    emit_word(a, value.data);
+                break;
+                case TokenRegister:
+                    emit_u8(a, tok.type == TokenJz ? OpJzR : OpJnzR);
+                    emit_u8(a, value.data);
+                break;
+                default:
+                    asm_error(a, value.at, "%s doesn't take %s", token_names[tok.type],
+                        token_names[value.type]);
+                break;
+            }
+            emit_target(a, target);
+        }break;
+
+        case TokenJeq:
+        case TokenJlt:
+        case TokenJgt:{
+            token x = take(a);
+            skip_comma(a);
+            token y = take(a);
+            skip_comma(a);
+            token target = take(a);
+
+            if(x.type == TokenAddress && y.type == TokenAddress) {
+                emit_u8(a, tok.type == TokenJeq ? OpJeqAA :
+                           tok.type == TokenJlt ? OpJltAA : OpJgtAA);
+                emit_word(a, x.data);
+                emit_word(a, y.data);
+            } else if(x.type == TokenRegister && y.type == TokenRegister) {
+                emit_u8(a, tok.type == TokenJeq ? OpJeqRR :
+                           tok.type == TokenJlt ? OpJltRR : OpJgtRR);
+                emit_u8(a, x.data);
+                emit_u8(a, y.data);
+            } else {
+                bad_operands(a, tok, x, y);
+            }
+            emit_target(a, target);
+        }break;
+
+        case TokenCall: {
+            token target = take(a);
+            // an `if` right before only skips one instruction, not a whole body
+            bool skipped = a->if_end && a->if_end == a->ip;
+            if(target.type == TokenSymbol && a->inline_depth < ASM_INLINE_DEPTH && !skipped) {
+                routine* r = find_routine(a, target.symbol);
+                if(r && r->inlined && !r->expanding) {
+                    inline_routine(a, r);
+                    break;
+                }
+            }
+            emit_u8(a, OpCall);
+            emit_target(a, target);
+        } break;
+
+        case TokenRet:
+            emit_u8(a, OpReturn);
+        break;
+
+        default:
+            asm_error(a, tok.at, "unexpected %s", token_names[tok.type]);
+        break;
+    }
+}
+
+static void record_instruction(assembler* a, u32 start) {
+    if(a->instructions_size == a->instructions_capacity)
+        a->instructions = asm_grow(a, a->instructions, &a->instructions_capacity, sizeof(instruction));
+
+    instruction* in = &a->instructions[a->instructions_size++];
+    in->type = a->tokens[start].type;
+    in->start = start;
+    in->end = a->next;
+
+    // jump targets are the last operand
+    switch(in->type) {
+        case TokenJmp: case TokenIf: case TokenJz: case TokenJnz:
+        case TokenJeq: case TokenJlt: case TokenJgt: case TokenCall:
+            if(a->tokens[in->end-1].type == TokenNumber)
+                a->numeric_targets = true;
+        break;
+    }
+}
+
+// why the body in instructions [first, last) would behave differently
+// without the return address of a `call` under it, NULL if it wouldn't
+static const char* routine_problem(assembler* a, const char* name, u32 first, u32 last) {
+    int depth = 0;          // bytes pushed since the routine started
+    bool sn_known = false;  // *0x00, the syscall number
+    word sn = 0;
+
+    for(u32 i = first; i < last; ++i) {
+        instruction* in = &a->instructions[i];
+        token* op = &a->tokens[in->start];
+
+        for(u32 j = in->start + 1; j < in->end; ++j) {
+            token* t = &a->tokens[j];
+            if(t->type == TokenRegister && (t->data == 0x03 || t->data == 0x04))
+                return "it uses rsp or rbp";
+            if(t->type == TokenFrame && (t->base == 0x03 || t->base == 0x04))
+                return "it uses rsp or rbp relative data";
+        }
+
+        switch(in->type) {
+            case TokenSymbol:
+                return "it has labels inside";
+            case TokenExport:
+            case TokenInline:
+                return "it has directives inside";
+            case TokenEnter:
+            case TokenLeave:
+                return "it has enter or leave in the middle";
+            case TokenJmp: case TokenIf: case TokenJz: case TokenJnz:
+            case TokenJeq: case TokenJlt: case TokenJgt:
+                return "it branches";
+            case TokenCall:
+                if(op[1].type == TokenSymbol && !strcmp(op[1].symbol, name))
+                    return "it calls itself";
+            break;
+
+            case TokenPush:  depth += sizeof(word); break;
+            case TokenPushB: depth += 1; break;
+            case TokenPop:   depth -= sizeof(word); break;
+            case TokenPopB:  depth -= 1; break;
+
+            case TokenSys: {
+                if(!sn_known || sn >= VM_SYSCALLS)
+                    return "its syscall number isn't known";
+                const vm_syscall_effect* e = &vm_syscall_effects[sn];
+                if(e->unknown)
+                    return "it calls an external function";
+                depth -= e->pops;
+                if(depth < 0)
+                    break;
+                depth += e->pushes;
+                if(e->writes_memory)
+                    sn_known = false;
+            } break;
+        }
+        if(depth < 0)
+            return "it pops what its caller pushed";
+
+        // keep track of *0x00
+        token* to = &a->tokens[in->end-1];
+        if(to->type == TokenAddress && to->data < sizeof(word)) {
+            if(in->type == TokenMov && to->data == 0 && op[1].type == TokenNumber) {
+                sn_known = true;
+                sn = op[1].data;
+            } else if(in->type == TokenMov || in->type == TokenNull ||
+                in->type == TokenPop || in->type == TokenPopB) {
+                sn_known = in->type == TokenNull && to->data == 0;
+                sn = 0;
+            }
+        }
+    }
+
+    if(depth != 0)
+        return "it leaves the stack unbalanced";
+    return NULL;
+}
+
+static void find_routines(assembler* a) {
+    for(u32 i = 0; i < a->instructions_size; ++i) {
+        instruction* label = &a->instructions[i];
+        if(label->type != TokenSymbol)
+            continue;
+
+        u32 first = i + 1;
+        u32 last = first;
+        while(last < a->instructions_size && a->instructions[last].type != TokenRet)
+            ++last;
+        if(last == a->instructions_size)
+            continue;
+
+        // enter/leave around a body that never looks at rbp do nothing ( a hand
+        // written push rbp / mov rsp , rbp isn't dropped, routine_problem turns
+        // those down for using rbp )
+        if(first < last && a->instructions[first].type == TokenEnter &&
+            a->instructions[last-1].type == TokenLeave) {
+            ++first;
+            --last;
+        }
+
+        if(a->routines_size == a->routines_capacity)
+            a->routines = asm_grow(a, a->routines, &a->routines_capacity, sizeof(routine));
+        char* name = a->tokens[label->start].symbol;
+        a->routines[a->routines_size++] = (routine) {
+            .name = name,
+            .first = first,
+            .last = last,
+            .problem = routine_problem(a, name, first, last),
+            // code can only move around when nothing jumps to a fixed address
+            .inlined = !a->numeric_targets && last - first <= ASM_INLINE_MAX,
+        };
+    }
+
+    for(u32 i = 0; i < a->routines_size; ++i)
+        if(a->routines[i].problem)
+            a->routines[i].inlined = false;
+
+    for(u32 i = 0; i < a->instructions_size; ++i) {
+        instruction* in = &a->instructions[i];
+        if(in->type != TokenInline)
+            continue;
+        token* t = &a->tokens[in->start + 1];
+        routine* r = find_routine(a, t->symbol);
+        if(!r)
+            asm_error(a, t->at, "can't inline %%%s, it isn't a label followed by code up to a ret", t->symbol);
+        if(r->problem)
+            asm_error(a, t->at, "can't inline %%%s, %s", t->symbol, r->problem);
+        if(a->numeric_targets)
+            asm_error(a, t->at, "can't inline %%%s, the file jumps to numeric addresses", t->symbol);
+        r->inlined = true;
+    }
+}
+
+static void gen_bytecode(assembler* a) {
+    while(a->tokens[a->next].type != TokenEOF) {
+        u32 start = a->next;
+        gen_instruction(a);
+        record_instruction(a, start);
+    }
+
+    find_routines(a);
+
+    bool again = false;
+    for(u32 i = 0; i < a->instructions_size && !again; ++i) {
+        token* target = &a->tokens[a->instructions[i].start + 1];
+        if(a->instructions[i].type == TokenCall && target->type == TokenSymbol) {
+            routine* r = find_routine(a, target->symbol);
+            again = r && r->inlined;
+        }
+    }
+    // numeric targets only show up as the first pass goes, so redo it if
+    // anything moved before we knew
+    if(a->numeric_targets && a->lowered)
+        again = true;
+    if(!again)
+        return;
+
+    // once more from the start, this time calls get inlined
+    memset(a->image, 0, a->ip);
+    a->ip = 0;
+    a->patches_size = 0;
+    a->next = 0;
+    a->if_end = 0;
+    while(a->tokens[a->next].type != TokenEOF)
+        gen_instruction(a);
+}
+
+static patch* find_decl(assembler* a, const char* id) {
+    for(u32 i = 0; i < a->patches_size; ++i)
+        if(a->patches[i].type == PATCH_DECL && !strcmp(a->patches[i].id, id))
+            return &a->patches[i];
+    return NULL;
+}
+
+static u32 object_symbol(assembler* a, pointer_object* object, const char* name, bool exported, word addr) {
+    for(u32 i = 0; i < object->symbols_size; ++i)
+        if(object->symbols[i].exported == exported && !strcmp(object->symbols[i].name, name))
+            return i;
+
+    if(object->symbols_size == a->symbols_capacity)
+        object->symbols = asm_grow(a, object->symbols, &a->symbols_capacity, sizeof(pointer_symbol));
+    char* copy = strdup(name);
+    if(!copy)
+        asm_error(a, 0, "out of memory");
+    object->symbols[object->symbols_size] = (pointer_symbol) {
+        .name = copy,
+        .exported = exported,
+        .addr = addr
+    };
+    return object->symbols_size++;
+}
+
+static void object_reloc(assembler* a, pointer_object* object, u8 type, u32 offset, u32 symbol) {
+    if(object->relocs_size == a->relocs_capacity)
+        object->relocs = asm_grow(a, object->relocs, &a->relocs_capacity, sizeof(pointer_reloc));
+    object->relocs[object->relocs_size++] = (pointer_reloc) {
+        .type = type,
+        .offset = offset,
+        .symbol = symbol
+    };
+}
+
+// fills in every label reference, without an object every label has to be
+// in this file, with one the ones that aren't become imports for the linker
+static void resolve(assembler* a, pointer_object* object) {
+    for(u32 i = 0; i < a->patches_size; ++i) {
+        patch* decl = &a->patches[i];
+        if(decl->type == PATCH_DECL && find_decl(a, decl->id) != decl)
+            asm_error(a, decl->at, "label %%%s is declared twice", decl->id);
+    }
+
+    for(u32 i = 0; i < a->patches_size; ++i) {
+        patch* p = &a->patches[i];
+        patch* decl = find_decl(a, p->id);
+
+        switch(p->type) {
+            case PATCH_REF:
+                if(decl) {
+                    memcpy(a->image + p->addr, &decl->addr, sizeof(word));
+                    if(object)
+                        object_reloc(a, object, RelocLocal, p->addr, 0);
+                } else if(object) {
+                    u32 symbol = object_symbol(a, object, p->id, false, 0);
+                    object_reloc(a, object, RelocImport, p->addr, symbol);
+                } else {
+                    asm_error(a, p->at, "unknown label %%%s", p->id);
+                }
+            break;
+            case PATCH_EXPORT:
+                if(!decl)
+                    asm_error(a, p->at, "exported label %%%s is never declared", p->id);
+                if(object)
+                    object_symbol(a, object, p->id, true, decl->addr);
+            break;
+        }
+    }
+}
+
+// pointer_assemble and pointer_assemble_object, `object` is NULL for the first
+static bool assemble(const char* source, size_t source_size, u8* image, u32* image_size,
+    pointer_object* object, char* error, size_t error_size) {
+    assembler a = {
+        .source_size = source_size,
+        .image = image,
+        .error = error,
+        .error_size = error_size,
+    };
+    if(error_size)
+        error[0] = 0;
+    memset(image, 0, POINTER_IMAGE_SIZE);
+    *image_size = 0;
+
+    // a null terminator makes looking one character ahead always safe
+    a.source = malloc(source_size + 1);
+    if(!a.source) {
+        snprintf(error, error_size, "out of memory");
+        return false;
+    }
+    memcpy(a.source, source, source_size);
+    a.source[source_size] = 0;
+
+    // volatile, it gets read after a longjmp
+    volatile bool ok = false;
+    if(!setjmp(a.fail)) {
+        lex(&a);
+        gen_bytecode(&a);
+        resolve(&a, object);
+        ok = true;
+    }
+
+    for(u32 i = 0; i < a.tokens_size; ++i)
+        if(a.tokens[i].type == TokenSymbol)
+            free(a.tokens[i].symbol);
+    free(a.tokens);
+    free(a.patches);
+    free(a.instructions);
+    free(a.routines);
+    free(a.source);
+
+    *image_size = ok ? a.ip : 0;
+    return ok;
+}
+
+bool pointer_assemble(const char* source, size_t source_size, u8* image, u32* image_size,
+    char* error, size_t error_size) {
+    u32 size;
+    bool ok = assemble(source, source_size, image, &size, NULL, error, error_size);
+    if(image_size)
+        *image_size = size;
+    return ok;
+}
+
+bool pointer_assemble_object(const char* source, size_t source_size, pointer_object* object,
+    char* error, size_t error_size) {
+    memset(object, 0, sizeof(*object));
+
+    u8* image = malloc(POINTER_IMAGE_SIZE);
+    if(!image) {
+        snprintf(error, error_size, "out of memory");
+        return false;
+    }
+
+    u32 size;
+    if(!assemble(source, source_size, image, &size, object, error, error_size)) {
+        free(image);
+        pointer_object_free(object);
+        return false;
+    }
+
+    // only keep the part of the image the code uses
+    object->code = realloc(image, size ? size : 1);
+    object->code_size = size;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "batch.h"
+
+#include <string.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_HAS_AVX2
+#endif
+
+// an instance on a VM of its own, for what lockstep can't run
+static vm_t* batch_vm(const vm_t* image, vm_io* io) {
+    vm_t* vm = calloc(1, sizeof(vm_t));
+    if(!vm)
+        return NULL;
+    if(!vm_init(vm)) {
+        free(vm);
+        return NULL;
+    }
+    memcpy(vm->data, image->data, sizeof(vm->data));
+    memcpy(vm->external, image->external, sizeof(vm->external));
+    memcpy(vm->starts, image->starts, sizeof(vm->starts));
+    vm->verified = image->verified;
+    vm->io = io;
+    return vm;
+}
+
+static void batch_result_of(const vm_t* vm, batch_result* result) {
+    result->trap = vm->trap;
+    result->trap_ip = vm->trap_ip;
+    result->r[0] = vm->r[0];
+    result->r[1] = vm->r[1];
+    result->r[2] = vm->r[2];
+    result->sp = vm->sp;
+    result->bp = vm->bp;
+}
+
+static void batch_finish(vm_t* vm, batch_result* result) {
+    execute_vm(vm);
+    batch_result_of(vm, result);
+}
+
+#ifndef POINTER_WIDE
+typedef u16   lanes      __attribute__((vector_size(BATCH_LANES * sizeof(u16))));
+typedef short slanes     __attribute__((vector_size(BATCH_LANES * sizeof(short))));
+typedef u8    lane_bytes __attribute__((vector_size(BATCH_LANES)));
+
+// a 256 bit vector isn't passed or returned the same way with and without
+// AVX ( GCC warns about it with -Wpsabi ), so the helpers take vectors by
+// pointer and hand them back through their first argument, BATCH_VALUE
+// turns such a call back into an expression
+#define BATCH_INLINE static inline __attribute__((always_inline))
+#define BATCH_VALUE(name, ...) \
+    ({ lanes batch_value_; VARIANT(name)(&batch_value_, __VA_ARGS__); batch_value_; })
+
+#ifdef __clang__
+#define BATCH_SHUFFLE(v, ...) __builtin_shufflevector(v, v, __VA_ARGS__)
+#else
+#define BATCH_SHUFFLE(v, ...) __builtin_shuffle(v, (lanes){ __VA_ARGS__ })
+#endif
+
+// byte `addr` of instance `lane`
+#define BATCH_BYTE(b, addr, lane) ((b)->memory[(size_t)(addr) * BATCH_LANES + (lane)])
+
+// memory gets cleared between batches only where it was written
+#define BATCH_BLOCK 0x100   // addresses
+#define BATCH_TOUCH(b, addr) ((b)->touched[(u32)(addr) / BATCH_BLOCK] = true)
+
+#define BATCH_WORKERS 64       // most threads evicted instances run on
+#define BATCH_SLICE   0x100000 // instructions an evicted instance runs before it lets another one go
+
+typedef struct batch batch;
+typedef struct batch_evicted batch_evicted;
+typedef struct batch_pool batch_pool;
+
+// a lane that carries on on a VM of its own
+struct batch_evicted {
+    vm_t* vm;
+    batch_result* result;
+    batch_evicted* next;
+};
+
+// evicted instances wait in a queue for a worker ( one per CPU ), a worker
+// runs one for BATCH_SLICE instructions and puts it back at the end when it
+// isn't done, so instances waiting on each other through channels take turns
+// ( a channel wait that runs out of budget stops right before its sys )
+struct batch_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    batch_evicted* first;
+    batch_evicted* last;
+    int pending;    // evicted instances that aren't done yet
+    bool closed;    // no more are coming, workers leave once pending is 0
+    pthread_t workers[BATCH_WORKERS];
+    int workers_size;
+    int workers_max;
+};
+
+// up to BATCH_LANES instances of one image, a lane each
+struct batch {
+    const vm_t* image;
+    u8* memory;         // VM_MEMORY_SIZE * BATCH_LANES bytes, see BATCH_BYTE
+    lanes r[VM_REGISTERS];
+    lanes ip;
+    lanes running;      // lanes that didn't stop yet
+    lanes m;            // lanes the current instruction runs on
+    word pc;            // and where it is
+    int live;
+    vm_io* io[BATCH_LANES];
+    batch_result* results[BATCH_LANES];
+    bool touched[VM_MEMORY_SIZE / BATCH_BLOCK];
+    bool failed;        // an instance couldn't get a VM of its own
+    batch_pool pool;    // where evicted instances run, joined once every batch is done
+};
+
+static word batch_word(const u8* at) {
+    word value;
+    memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+// the lane is done, its registers get copied once the whole batch is
+static void batch_stop(batch* b, int lane, u8 trap, word ip) {
+    batch_result* result = b->results[lane];
+    result->trap = trap;
+    result->trap_ip = trap ? ip : 0;
+    result->lockstep = true;
+    b->running[lane] = 0;
+    b->m[lane] = 0;
+    --b->live;
+}
+
+// runs the instance for a slice, false when it isn't done yet
+static bool batch_slice(batch_evicted* e) {
+    vm_t* vm = e->vm;
+    vm->budget = BATCH_SLICE;
+    execute_vm(vm);
+    // evicted instances have no budget of their own, so this is only the slice
+    if(vm->trap == TrapBudget) {
+        vm->trap = TrapNone;
+        vm->trap_ip = 0;
+        vm->halted = false;
+        return false;
+    }
+    batch_result_of(vm, e->result);
+    vm_destroy(vm);
+    free(vm);
+    free(e);
+    return true;
+}
+
+static void batch_pool_push(batch_pool* p, batch_evicted* e) {
+    e->next = NULL;
+    if(p->last)
+        p->last->next = e;
+    else
+        p->first = e;
+    p->last = e;
+    pthread_cond_signal(&p->ready);
+}
+
+static void* batch_worker(void* arg) {
+    batch_pool* p = arg;
+    pthread_mutex_lock(&p->lock);
+    for(;;) {
+        while(!p->first && !(p->closed && !p->pending))
+            pthread_cond_wait(&p->ready, &p->lock);
+        batch_evicted* e = p->first;
+        if(!e)
+            break;
+        p->first = e->next;
+        if(!p->first)
+            p->last = NULL;
+
+        pthread_mutex_unlock(&p->lock);
+        bool done = batch_slice(e);
+        pthread_mutex_lock(&p->lock);
+
+        if(!done)
+            batch_pool_push(p, e);
+        else if(!--p->pending)
+            pthread_cond_broadcast(&p->ready);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// one worker per CPU, up to BATCH_WORKERS
+static int batch_cpus(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int cpus = info.dwNumberOfProcessors;
+#else
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cpus < 1 ? 1 : cpus < BATCH_WORKERS ? cpus : BATCH_WORKERS;
+}
+
+// carries on the lane from `ip` on a VM of its own, on the workers so a
+// lane that blocks on a channel doesn't stop the others ( or the lane it
+// waits for )
+static void batch_evict(batch* b, int lane, word ip) {
+    batch_stop(b, lane, TrapNone, 0);
+    b->results[lane]->lockstep = false;
+    vm_t* vm = batch_vm(b->image, b->io[lane]);
+    batch_evicted* e = vm ? malloc(sizeof(batch_evicted)) : NULL;
+    if(!e) {
+        if(vm) {
+            vm_destroy(vm);
+            free(vm);
+        }
+        b->failed = true;
+        return;
+    }
+    for(u32 addr = 0; addr < VM_MEMORY_SIZE; ++addr)
+        vm->memory[addr] = BATCH_BYTE(b, addr, lane);
+    vm->r[0] = b->r[0][lane];
+    vm->r[1] = b->r[1][lane];
+    vm->r[2] = b->r[2][lane];
+    vm->sp = b->r[3][lane];
+    vm->bp = b->r[4][lane];
+    vm->ip = ip;
+    *e = (batch_evicted){ .vm = vm, .result = b->results[lane] };
+
+    batch_pool* p = &b->pool;
+    pthread_mutex_lock(&p->lock);
+    // one more worker while there are CPUs for them
+    if(p->workers_size < p->workers_max && p->workers_size <= p->pending &&
+        !pthread_create(&p->workers[p->workers_size], NULL, batch_worker, p))
+        ++p->workers_size;
+    bool alone = !p->workers_size;
+    if(!alone) {
+        ++p->pending;
+        batch_pool_push(p, e);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    // no thread for it, so it runs right here
+    if(alone)
+        while(!batch_slice(e));
+}
+
+#define BATCH_AVX2 0
+#include "batch.inc"
+#undef BATCH_AVX2
+
+#ifdef BATCH_HAS_AVX2
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define BATCH_AVX2 1
+#include "batch.inc"
+#undef BATCH_AVX2
+#pragma GCC pop_options
+#endif
+
+static bool batch_lockstep(const vm_t* image, u32 count, vm_io* ios, batch_result* results) {
+    batch b = { .image = image };
+    b.memory = calloc(VM_MEMORY_SIZE, BATCH_LANES);
+    if(!b.memory) {
+        printf("ERROR: Couldn't allocate the memory of %d lanes\n", BATCH_LANES);
+        return false;
+    }
+    pthread_mutex_init(&b.pool.lock, NULL);
+    pthread_cond_init(&b.pool.ready, NULL);
+    b.pool.workers_max = batch_cpus();
+
+    void (*run)(batch*) = batch_run_generic;
+#ifdef BATCH_HAS_AVX2
+    if(__builtin_cpu_supports("avx2"))
+        run = batch_run_avx2;
+#endif
+
+    for(u32 first = 0; first < count; first += BATCH_LANES) {
+        u32 n = count - first < BATCH_LANES ? count - first : BATCH_LANES;
+        for(u32 block = 0; block < VM_MEMORY_SIZE / BATCH_BLOCK; ++block) {
+            if(b.touched[block])
+                memset(&BATCH_BYTE(&b, block * BATCH_BLOCK, 0), 0, BATCH_BLOCK * BATCH_LANES);
+            b.touched[block] = false;
+        }
+        memset(b.r, 0, sizeof(b.r));
+        memset(&b.ip, 0, sizeof(b.ip));
+        memset(&b.running, 0, sizeof(b.running));
+        for(u32 lane = 0; lane < n; ++lane) {
+            b.running[lane] = 0xFFFF;
+            b.io[lane] = ios ? &ios[first + lane] : NULL;
+            b.results[lane] = &results[first + lane];
+        }
+        b.live = n;
+        run(&b);
+
+        for(u32 lane = 0; lane < n; ++lane) {
+            batch_result* result = b.results[lane];
+            if(!result->lockstep)
+                continue;
+            result->r[0] = b.r[0][lane];
+            result->r[1] = b.r[1][lane];
+            result->r[2] = b.r[2][lane];
+            result->sp = b.r[3][lane];
+            result->bp = b.r[4][lane];
+        }
+    }
+
+    batch_pool* p = &b.pool;
+    pthread_mutex_lock(&p->lock);
+    p->closed = true;
+    pthread_cond_broadcast(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+    for(int i = 0; i < p->workers_size; ++i)
+        pthread_join(p->workers[i], NULL);
+    pthread_cond_destroy(&p->ready);
+    pthread_mutex_destroy(&p->lock);
+
+    free(b.memory);
+    return !b.failed;
+}
+#endif
+
+bool batch_run(const vm_t* image, u32 count, vm_io* ios, batch_result* results) {
+#ifndef POINTER_WIDE
+    if(image->verified)
+        return batch_lockstep(image, count, ios, results);
+#endif
+    // one VM that gets reset between instances
+    vm_t* vm = batch_vm(image, NULL);
+    if(!vm)
+        return false;
+    for(u32 i = 0; i < count; ++i) {
+        if(i)
+            vm_reset(vm);
+        vm->io = ios ? &ios[i] : NULL;
+        results[i].lockstep = false;
+        batch_finish(vm, &results[i]);
+    }
+    vm_destroy(vm);
+    free(vm);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "channel.h"
+
+typedef struct channel_slot channel_slot;
+
+struct channel_slot {
+    atomic_size_t seq;  // tells whose turn it is to use this slot
+    u16 size;
+    u8 data[CHANNEL_MSG_SIZE];
+};
+
+struct channel {
+    size_t mask;
+    channel_slot* slots;
+    const void* _Atomic receiver; // the single consumer, NULL until somebody receives
+    // keep the producer and consumer counters on different cache lines
+    _Alignas(64) atomic_size_t head; // next slot to send into
+    _Alignas(64) atomic_size_t tail; // next slot to receive from
+};
+
+static channel* _Atomic channels[CHANNEL_MAX] = {0};
+
+channel* channel_open(word id, word capacity) {
+    if(id >= CHANNEL_MAX)
+        return NULL;
+    channel* ch = atomic_load_explicit(&channels[id], memory_order_acquire);
+    if(ch)
+        return ch;
+
+    size_t slots_size = 2;
+    while(slots_size < capacity && slots_size < CHANNEL_CAPACITY)
+        slots_size <<= 1;
+
+    ch = vm_aligned_alloc(64, sizeof(channel));
+    if(!ch) {
+        printf("ERROR: Couldn't allocate channel 0x%02X\n", (u32)id);
+        return NULL;
+    }
+    ch->mask = slots_size - 1;
+    ch->slots = malloc(sizeof(channel_slot) * slots_size);
+    if(!ch->slots) {
+        printf("ERROR: Couldn't allocate %zu slots for channel 0x%02X\n", slots_size, (u32)id);
+        vm_aligned_free(ch);
+        return NULL;
+    }
+    for(size_t i = 0; i < slots_size; ++i)
+        atomic_init(&ch->slots[i].seq, i);
+    atomic_init(&ch->receiver, NULL);
+    atomic_init(&ch->head, 0);
+    atomic_init(&ch->tail, 0);
+
+    // somebody else may have created it in the meantime, use theirs
+    channel* expected = NULL;
+    if(!atomic_compare_exchange_strong_explicit(&channels[id], &expected, ch,
+        memory_order_acq_rel, memory_order_acquire)) {
+        free(ch->slots);
+        vm_aligned_free(ch);
+        return expected;
+    }
+    return ch;
+}
+
+channel* channel_get(word id) {
+    if(id >= CHANNEL_MAX)
+        return NULL;
+    return atomic_load_explicit(&channels[id], memory_order_acquire);
+}
+
+bool channel_claim(channel* ch, const void* receiver) {
+    const void* current = atomic_load_explicit(&ch->receiver, memory_order_acquire);
+    if(current == receiver)
+        return true;
+    const void* expected = NULL;
+    return !current && atomic_compare_exchange_strong_explicit(&ch->receiver, &expected, receiver,
+        memory_order_acq_rel, memory_order_acquire);
+}
+
+void channel_release(const void* receiver) {
+    for(int id = 0; id < CHANNEL_MAX; ++id) {
+        channel* ch = atomic_load_explicit(&channels[id], memory_order_acquire);
+        const void* expected = receiver;
+        if(ch)
+            atomic_compare_exchange_strong_explicit(&ch->receiver, &expected, NULL,
+                memory_order_acq_rel, memory_order_relaxed);
+    }
+}
+
+bool channel_try_send(channel* ch, const u8* buf, word size) {
+    channel_slot* slot;
+    size_t pos = atomic_load_explicit(&ch->head, memory_order_relaxed);
+
+    for(;;) {
+        slot = &ch->slots[pos & ch->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if(dif == 0) {
+            if(atomic_compare_exchange_weak_explicit(&ch->head, &pos, pos+1,
+                memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if(dif < 0) {
+            return false; // full
+        } else {
+            pos = atomic_load_explicit(&ch->head, memory_order_relaxed);
+        }
+    }
+
+    if(size > CHANNEL_MSG_SIZE)
+        size = CHANNEL_MSG_SIZE;
+    memcpy(slot->data, buf, size);
+    slot->size = size;
+    atomic_store_explicit(&slot->seq, pos+1, memory_order_release);
+    return true;
+}
+
+bool channel_try_recv(channel* ch, u8* buf, word max_size, word* size) {
+    // single consumer, so no need to fight over the tail
+    size_t pos = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+    channel_slot* slot = &ch->slots[pos & ch->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if((intptr_t)seq - (intptr_t)(pos+1) < 0)
+        return false; // empty
+
+    word n = slot->size < max_size ? slot->size : max_size;
+    memcpy(buf, slot->data, n);
+    *size = n;
+
+    atomic_store_explicit(&ch->tail, pos+1, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, pos + ch->mask + 1, memory_order_release);
+    return true;
+}
+
+// spends a wait out of the budget and yields, false when there isn't
+// enough left ( the instruction that's waiting keeps the last one )
+static bool channel_wait(unsigned long long* budget) {
+    if(*budget) {
+        if(*budget <= CHANNEL_WAIT_COST)
+            return false;
+        *budget -= CHANNEL_WAIT_COST;
+    }
+    sched_yield();
+    return true;
+}
+
+bool channel_send(channel* ch, const u8* buf, word size, unsigned long long* budget) {
+    while(!channel_try_send(ch, buf, size))
+        if(!channel_wait(budget))
+            return false;
+    return true;
+}
+
+bool channel_recv(channel* ch, u8* buf, word max_size, word* size, unsigned long long* budget) {
+    while(!channel_try_recv(ch, buf, max_size, size))
+        if(!channel_wait(budget))
+            return false;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "heap.h"
+
+#define HEAP_LIVE 0x80  // in heap_block.state, the block is allocated
+
+typedef struct heap_block heap_block;
+
+// one per granule of the region, only the ones where a block starts get used
+struct heap_block {
+    word requested;
+    word next;      // next free block of the same class, 0 ends the list
+    u8 state;       // 0 when no block starts here, otherwise class + 1 ( | HEAP_LIVE )
+};
+
+struct heap {
+    word base;
+    heap_block* blocks;
+    word free_lists[HEAP_CLASSES];
+    heap_stats stats;
+};
+
+#define BLOCK_SIZE(class) ((unsigned long long)HEAP_GRANULE << (class))
+
+// smallest class that holds `size` bytes, HEAP_CLASSES when none does
+static u8 heap_class(word size) {
+    u8 class = 0;
+    while(class < HEAP_CLASSES && BLOCK_SIZE(class) < size)
+        ++class;
+    return class;
+}
+
+// the live block that starts at `addr`, NULL for anything else
+static heap_block* heap_block_at(heap* h, word addr) {
+    if(addr < h->base || (u32)(addr - h->base) >= h->stats.top || (addr - h->base) % HEAP_GRANULE)
+        return NULL;
+    heap_block* b = &h->blocks[(addr - h->base) / HEAP_GRANULE];
+    return b->state & HEAP_LIVE ? b : NULL;
+}
+
+bool heap_init(vm_t* vm, word addr, word size) {
+    heap_release(vm);
+
+    // blocks are aligned to the granule, and the heap stays away from the stack
+    unsigned long long start = ((unsigned long long)addr + HEAP_GRANULE - 1) / HEAP_GRANULE * HEAP_GRANULE;
+    unsigned long long end = ((unsigned long long)addr + size) / HEAP_GRANULE * HEAP_GRANULE;
+    if(start < VM_STACK_SIZE || end > VM_MEMORY_SIZE || end <= start)
+        return false;
+
+    heap* h = calloc(1, sizeof(heap));
+    if(!h)
+        return false;
+    // calloc'd, so a big region only costs the granules that get used
+    h->blocks = calloc((end - start) / HEAP_GRANULE, sizeof(heap_block));
+    if(!h->blocks) {
+        free(h);
+        return false;
+    }
+    h->base = start;
+    h->stats.size = end - start;
+    vm->heap = h;
+    return true;
+}
+
+void heap_release(vm_t* vm) {
+    if(!vm->heap)
+        return;
+    free(vm->heap->blocks);
+    free(vm->heap);
+    vm->heap = NULL;
+}
+
+word heap_alloc(vm_t* vm, word size) {
+    heap* h = vm->heap;
+    if(!h || !size)
+        return 0;
+
+    u8 class = heap_class(size);
+    word addr;
+    if(class < HEAP_CLASSES && h->free_lists[class]) {
+        addr = h->free_lists[class];
+        h->free_lists[class] = h->blocks[(addr - h->base) / HEAP_GRANULE].next;
+        h->stats.free -= BLOCK_SIZE(class);
+    } else if(class < HEAP_CLASSES && h->stats.top + BLOCK_SIZE(class) <= h->stats.size) {
+        addr = h->base + h->stats.top;
+        h->stats.top += BLOCK_SIZE(class);
+    } else {
+        h->stats.failed += 1;
+        return 0;
+    }
+
+    heap_block* b = &h->blocks[(addr - h->base) / HEAP_GRANULE];
+    b->requested = size;
+    b->state = (class + 1) | HEAP_LIVE;
+
+    h->stats.allocs += 1;
+    h->stats.requested += size;
+    h->stats.in_use += BLOCK_SIZE(class);
+    if(h->stats.in_use > h->stats.peak)
+        h->stats.peak = h->stats.in_use;
+    return addr;
+}
+
+void heap_free(vm_t* vm, word addr) {
+    heap* h = vm->heap;
+    heap_block* b = h ? heap_block_at(h, addr) : NULL;
+    if(!b)
+        return;
+
+    u8 class = (b->state & ~HEAP_LIVE) - 1;
+    b->state &= ~HEAP_LIVE;
+    b->next = h->free_lists[class];
+    h->free_lists[class] = addr;
+
+    h->stats.frees += 1;
+    h->stats.requested -= b->requested;
+    h->stats.in_use -= BLOCK_SIZE(class);
+    h->stats.free += BLOCK_SIZE(class);
+}
+
+word heap_realloc(vm_t* vm, word addr, word size) {
+    heap* h = vm->heap;
+    if(!addr)
+        return heap_alloc(vm, size);
+    heap_block* b = h ? heap_block_at(h, addr) : NULL;
+    if(!b) {
+        if(h)
+            h->stats.failed += 1;
+        return 0;
+    }
+    if(!size) {
+        heap_free(vm, addr);
+        return 0;
+    }
+
+    // still the same class, the block just holds a different amount now
+    if(heap_class(size) == (b->state & ~HEAP_LIVE) - 1) {
+        h->stats.requested += size - b->requested;
+        b->requested = size;
+        return addr;
+    }
+
+    word moved = heap_alloc(vm, size);
+    if(!moved)
+        return 0;
+    b = &h->blocks[(addr - h->base) / HEAP_GRANULE];
+    memcpy(vm->memory + moved, vm->memory + addr, b->requested < size ? b->requested : size);
+    heap_free(vm, addr);
+    return moved;
+}
+
+bool heap_get_stats(vm_t* vm, heap_stats* stats) {
+    if(!vm->heap)
+        return false;
+    *stats = vm->heap->stats;
+    return true;
+}
\ No newline at end of file
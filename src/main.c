@@ -1,23 +1,169 @@
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #define ARR_SIZE(arr) (sizeof(arr)/sizeof(*arr))
 #include "vm.h"
+#include "trace.h"
+#include "window.h"
+#include "heap.h"
+#include "server.h"
 
+static void* run_vm(void* vm) {
+    execute_vm(vm);
+    return NULL;
+}
+
+// ptr [--verify] [--heap-stats] [--budget <n>] [--trace <file>] [--file|--file-rw <path>]... <image> [image...]
+// ptr --serve <socket> [--warm <vms>] [--budget <n>] <image> [image...]
+// every image gets its own VM, when there is more than one they all run at
+// the same time on their own thread, and can talk to each other through channels
+// --verify only prints what the verifier could prove about every image
+// --heap-stats prints the heap counters of every VM that made a heap once it's done
+// --file attaches a host file for the programs to map ( see window.h ), they
+// are numbered in order from 0, every VM opens them on its own
+// --budget traps a VM once it ran that many instructions ( see vm_t.budget )
+// --serve keeps the images loaded and runs them on request ( see server.h ),
+// image indices go in the order they were given, every request gets the
+// --budget or SERVER_BUDGET instructions, the VMs that run requests are
+// copies made by the server, so no --trace or --file with it
 int main(int argc, char** argv) {
-    if(argc < 2) {
+    char* trace_path = NULL;
+    bool verify_only = false;
+    bool print_heap = false;
+    char* serve_path = NULL;
+    int warm = 4;
+    unsigned long long budget = 0;
+    int first = 1;
+    char* files[WINDOW_FILES];
+    bool files_writable[WINDOW_FILES];
+    int files_size = 0;
+
+    for(;;) {
+        if(argc > first && !strcmp(argv[first], "--verify")) {
+            verify_only = true;
+            first += 1;
+        } else if(argc > first + 1 && !strcmp(argv[first], "--serve")) {
+            serve_path = argv[first+1];
+            first += 2;
+        } else if(argc > first + 1 && !strcmp(argv[first], "--warm")) {
+            warm = atoi(argv[first+1]);
+            first += 2;
+        } else if(argc > first + 1 && !strcmp(argv[first], "--budget")) {
+            budget = strtoull(argv[first+1], NULL, 0);
+            first += 2;
+        } else if(argc > first && !strcmp(argv[first], "--heap-stats")) {
+            print_heap = true;
+            first += 1;
+        } else if(argc > first + 1 && !strcmp(argv[first], "--trace")) {
+            trace_path = argv[first+1];
+            first += 2;
+        } else if(argc > first + 1 && (!strcmp(argv[first], "--file") || !strcmp(argv[first], "--file-rw"))) {
+            if(files_size == WINDOW_FILES) {
+                printf("ERROR: More than %d files\n", WINDOW_FILES);
+                return 1;
+            }
+            files_writable[files_size] = !strcmp(argv[first], "--file-rw");
+            files[files_size++] = argv[first+1];
+            first += 2;
+        } else {
+            break;
+        }
+    }
+
+    if(argc - first < 1) {
         return 1;
     }
+    if(serve_path && (trace_path || files_size)) {
+        printf("ERROR: --serve can't be used with --trace or --file\n");
+        return 1;
+    }
+
+    int vms_size = argc - first;
+    vm_t* vms = calloc(vms_size, sizeof(vm_t));
+
+    for(int i = 0; i < vms_size; ++i) {
+        if(!vm_init(&vms[i]))
+            return 1;
 
-    FILE* fp = fopen(argv[1], "rb");
+        FILE* fp = fopen(argv[first+i], "rb");
+        if(!fp) {
+            printf("ERROR: Couldn't open file %s\n", argv[first+i]);
+            return 1;
+        }
 
-    vm_t vm = {0};
+        fread(vms[i].data, sizeof(*vms[i].data), ARR_SIZE(vms[i].data), fp);
 
-    fread(vm.data, sizeof(*vm.data), ARR_SIZE(vm.data), fp) != sizeof(vm.data);
+        fclose(fp);
 
-    fclose(fp);
+        vms[i].budget = budget;
+        for(int f = 0; f < files_size; ++f)
+            if(!window_attach(&vms[i], f, files[f], files_writable[f]))
+                return 1;
 
-    execute_vm(&vm);
+        // images that can't be proven safe run with every check on
+        vm_verify_report report;
+        vm_verify(&vms[i], &report);
+        if(verify_only) {
+            printf("%s: ", argv[first+i]);
+            if(vms[i].verified)
+                printf("verified, stack up to 0x%04X\n", (u32)report.stack_max);
+            else
+                printf("runs checked, %s at 0x%04X\n", report.error, (u32)report.error_ip);
+            continue;
+        }
 
-    //vm_dump_memory(&vm, 2);
-    return 0;
+        // one trace file per VM, <file>.<index> when there is more than one
+        if(trace_path) {
+            char path[512];
+            if(vms_size == 1)
+                snprintf(path, sizeof(path), "%s", trace_path);
+            else
+                snprintf(path, sizeof(path), "%s.%d", trace_path, i);
+            if(!(vms[i].trace = trace_start(path)))
+                return 1;
+        }
+    }
+
+    if(serve_path)
+        return server_run(serve_path, vms, vms_size, warm, budget ? budget : SERVER_BUDGET) ? 0 : 1;
+
+    if(verify_only) {
+        for(int i = 0; i < vms_size; ++i)
+            vm_destroy(&vms[i]);
+        free(vms);
+        return 0;
+    }
+
+    if(vms_size == 1) {
+        execute_vm(&vms[0]);
+    } else {
+        pthread_t* threads = malloc(sizeof(pthread_t) * vms_size);
+        for(int i = 0; i < vms_size; ++i)
+            pthread_create(&threads[i], NULL, run_vm, &vms[i]);
+        for(int i = 0; i < vms_size; ++i)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    }
+
+    //vm_dump_memory(&vms[0], 2);
+    int result = 0;
+    for(int i = 0; i < vms_size; ++i) {
+        if(vms[i].trap) {
+            printf("ERROR: %s trapped, %s at 0x%04X\n", argv[first+i],
+                vm_trap_names[vms[i].trap], (u32)vms[i].trap_ip);
+            result = 1;
+        }
+        heap_stats stats;
+        if(print_heap && heap_get_stats(&vms[i], &stats)) {
+            printf("%s: heap of 0x%X bytes, 0x%X cut, 0x%X in use ( 0x%X asked for ), peak 0x%X, 0x%X free, %u allocs, %u frees, %u failed\n",
+                argv[first+i], stats.size, stats.top, stats.in_use, stats.requested, stats.peak,
+                stats.free, stats.allocs, stats.frees, stats.failed);
+        }
+        if(vms[i].trace)
+            trace_stop(vms[i].trace);
+        vm_destroy(&vms[i]);
+    }
+    free(vms);
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include <string.h>
+
+#include "pointer.h"
+
+/*
+    Object file layout:
+        "PTRO", u8 POINTER_OBJECT_VERSION, u8 sizeof(word)
+        u32 code size, the code
+        u32 symbol count, then per symbol:
+            u8 exported, word addr, u16 name size, the name
+        u32 relocation count, then per relocation:
+            u8 type, u32 offset, u32 symbol
+*/
+
+void pointer_object_free(pointer_object* object) {
+    for(u32 i = 0; i < object->symbols_size; ++i)
+        free(object->symbols[i].name);
+    free(object->symbols);
+    free(object->relocs);
+    free(object->code);
+    memset(object, 0, sizeof(*object));
+}
+
+bool pointer_object_save(const pointer_object* object, const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if(!fp)
+        return false;
+
+    fwrite(POINTER_OBJECT_MAGIC, 1, 4, fp);
+    fputc(POINTER_OBJECT_VERSION, fp);
+    fputc(sizeof(word), fp);
+
+    fwrite(&object->code_size, sizeof(u32), 1, fp);
+    fwrite(object->code, 1, object->code_size, fp);
+
+    fwrite(&object->symbols_size, sizeof(u32), 1, fp);
+    for(u32 i = 0; i < object->symbols_size; ++i) {
+        pointer_symbol* s = &object->symbols[i];
+        u16 name_size = strlen(s->name);
+        fputc(s->exported, fp);
+        fwrite(&s->addr, sizeof(word), 1, fp);
+        fwrite(&name_size, sizeof(u16), 1, fp);
+        fwrite(s->name, 1, name_size, fp);
+    }
+
+    fwrite(&object->relocs_size, sizeof(u32), 1, fp);
+    for(u32 i = 0; i < object->relocs_size; ++i) {
+        pointer_reloc* r = &object->relocs[i];
+        fputc(r->type, fp);
+        fwrite(&r->offset, sizeof(u32), 1, fp);
+        fwrite(&r->symbol, sizeof(u32), 1, fp);
+    }
+
+    bool ok = !ferror(fp);
+    return fclose(fp) == 0 && ok;
+}
+
+static bool read_exact(FILE* fp, void* out, size_t size) {
+    return fread(out, 1, size, fp) == size;
+}
+
+bool pointer_object_load(pointer_object* object, const char* path, char* error, size_t error_size) {
+    memset(object, 0, sizeof(*object));
+
+    FILE* fp = fopen(path, "rb");
+    if(!fp) {
+        snprintf(error, error_size, "couldn't open %s", path);
+        return false;
+    }
+
+    const char* problem = NULL;
+    u8 header[6];
+    if(!read_exact(fp, header, sizeof(header)) || memcmp(header, POINTER_OBJECT_MAGIC, 4)) {
+        problem = "not an object file";
+        goto fail;
+    }
+    if(header[4] != POINTER_OBJECT_VERSION) {
+        problem = "made by a different version of the assembler";
+        goto fail;
+    }
+    if(header[5] != sizeof(word)) {
+        problem = "assembled for a different word size";
+        goto fail;
+    }
+
+    problem = "truncated or corrupted";
+
+    if(!read_exact(fp, &object->code_size, sizeof(u32)) || object->code_size > POINTER_IMAGE_SIZE)
+        goto fail;
+    object->code = malloc(object->code_size ? object->code_size : 1);
+    if(!object->code || !read_exact(fp, object->code, object->code_size))
+        goto fail;
+
+    u32 symbols_size;
+    if(!read_exact(fp, &symbols_size, sizeof(u32)) || symbols_size > object->code_size + 0x10000)
+        goto fail;
+    object->symbols = calloc(symbols_size ? symbols_size : 1, sizeof(pointer_symbol));
+    if(!object->symbols)
+        goto fail;
+    while(object->symbols_size < symbols_size) {
+        pointer_symbol* s = &object->symbols[object->symbols_size];
+        u8 exported;
+        u16 name_size;
+        if(!read_exact(fp, &exported, 1) || !read_exact(fp, &s->addr, sizeof(word)) ||
+            !read_exact(fp, &name_size, sizeof(u16)))
+            goto fail;
+        s->exported = exported;
+        if(s->exported && s->addr > object->code_size)
+            goto fail;
+        if(!(s->name = malloc(name_size + 1)))
+            goto fail;
+        // counted before reading the name, so a failure still frees it
+        ++object->symbols_size;
+        if(!read_exact(fp, s->name, name_size))
+            goto fail;
+        s->name[name_size] = 0;
+    }
+
+    u32 relocs_size;
+    if(!read_exact(fp, &relocs_size, sizeof(u32)) || relocs_size > object->code_size)
+        goto fail;
+    object->relocs = malloc(sizeof(pointer_reloc) * (relocs_size ? relocs_size : 1));
+    if(!object->relocs)
+        goto fail;
+    for(; object->relocs_size < relocs_size; ++object->relocs_size) {
+        pointer_reloc* r = &object->relocs[object->relocs_size];
+        if(!read_exact(fp, &r->type, 1) || !read_exact(fp, &r->offset, sizeof(u32)) ||
+            !read_exact(fp, &r->symbol, sizeof(u32)))
+            goto fail;
+        if(r->type > RelocImport || (unsigned long long)r->offset + sizeof(word) > object->code_size)
+            goto fail;
+        if(r->type == RelocImport &&
+            (r->symbol >= object->symbols_size || object->symbols[r->symbol].exported))
+            goto fail;
+    }
+
+    fclose(fp);
+    return true;
+
+fail:
+    snprintf(error, error_size, "%s is %s", path, problem);
+    fclose(fp);
+    pointer_object_free(object);
+    return false;
+}
+
+typedef struct link_export link_export;
+
+struct link_export {
+    const char* name;
+    word addr;      // in the image
+    u32 object;
+};
+
+bool pointer_link(const pointer_object* objects, u32 objects_size, u8* image, u32* image_size,
+    char* error, size_t error_size) {
+    if(error_size)
+        error[0] = 0;
+    memset(image, 0, POINTER_IMAGE_SIZE);
+    if(image_size)
+        *image_size = 0;
+
+    bool ok = false;
+    u32* bases = malloc(sizeof(u32) * (objects_size + 1));
+    u32 exports_size = 0;
+    for(u32 i = 0; i < objects_size; ++i)
+        exports_size += objects[i].symbols_size;
+    link_export* exports = malloc(sizeof(link_export) * (exports_size + 1));
+    if(!bases || !exports) {
+        snprintf(error, error_size, "out of memory");
+        goto done;
+    }
+
+    // objects go one after the other
+    u32 size = 0;
+    for(u32 i = 0; i < objects_size; ++i) {
+        bases[i] = size;
+        size += objects[i].code_size;
+        if(size > POINTER_IMAGE_SIZE) {
+            snprintf(error, error_size, "the objects take 0x%X bytes, more than fit in an image", size);
+            goto done;
+        }
+        memcpy(image + bases[i], objects[i].code, objects[i].code_size);
+    }
+
+    exports_size = 0;
+    for(u32 i = 0; i < objects_size; ++i) {
+        for(u32 j = 0; j < objects[i].symbols_size; ++j) {
+            pointer_symbol* s = &objects[i].symbols[j];
+            if(!s->exported)
+                continue;
+            for(u32 k = 0; k < exports_size; ++k) {
+                if(!strcmp(exports[k].name, s->name)) {
+                    snprintf(error, error_size, "%%%s is exported by object %u and object %u",
+                        s->name, exports[k].object, i);
+                    goto done;
+                }
+            }
+            exports[exports_size++] = (link_export) {
+                .name = s->name,
+                .addr = bases[i] + s->addr,
+                .object = i
+            };
+        }
+    }
+
+    for(u32 i = 0; i < objects_size; ++i) {
+        for(u32 j = 0; j < objects[i].relocs_size; ++j) {
+            pointer_reloc* r = &objects[i].relocs[j];
+            u8* at = image + bases[i] + r->offset;
+            word addr;
+            memcpy(&addr, at, sizeof(word));
+
+            if(r->type == RelocLocal) {
+                addr += bases[i];
+            } else {
+                const char* name = objects[i].symbols[r->symbol].name;
+                u32 k = 0;
+                while(k < exports_size && strcmp(exports[k].name, name))
+                    ++k;
+                if(k == exports_size) {
+                    snprintf(error, error_size, "%%%s, used by object %u, isn't exported by any object",
+                        name, i);
+                    goto done;
+                }
+                addr = exports[k].addr;
+            }
+            memcpy(at, &addr, sizeof(word));
+        }
+    }
+
+    if(image_size)
+        *image_size = size;
+    ok = true;
+
+done:
+    free(bases);
+    free(exports);
+    return ok;
+}
\ No newline at end of file
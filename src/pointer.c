@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "pointer.h"
+#include "window.h"
+
+vm_t* pointer_create(const u8* image, u32 image_size) {
+    vm_t* vm = calloc(1, sizeof(vm_t));
+    if(!vm)
+        return NULL;
+    if(!vm_init(vm)) {
+        free(vm);
+        return NULL;
+    }
+
+    if(image_size > sizeof(vm->data))
+        image_size = sizeof(vm->data);
+    memcpy(vm->data, image, image_size);
+
+    // images that can't be proven safe run with every check on
+    vm_verify(vm, NULL);
+    return vm;
+}
+
+void pointer_destroy(vm_t* vm) {
+    vm_destroy(vm);
+    free(vm);
+}
+
+bool pointer_attach_file(vm_t* vm, u8 index, const char* path, bool writable) {
+    return window_attach(vm, index, path, writable);
+}
+
+bool pointer_heap_stats(vm_t* vm, heap_stats* stats) {
+    return heap_get_stats(vm, stats);
+}
+
+u8 pointer_run(vm_t* vm) {
+    execute_vm(vm);
+    return vm->trap;
+}
+
+bool pointer_run_batch(vm_t* vm, u32 count, vm_io* ios, batch_result* results) {
+    return batch_run(vm, count, ios, results);
+}
+
+word pointer_register(vm_t* vm, u8 index) {
+    if(index >= VM_REGISTERS)
+        return 0;
+    return *VM_REGISTER(vm, index);
+}
+
+bool pointer_read(vm_t* vm, word addr, void* out, size_t size) {
+    if((unsigned long long)addr + size > VM_MEMORY_SIZE)
+        return false;
+    memcpy(out, vm->memory + addr, size);
+    return true;
+}
+
+bool pointer_write(vm_t* vm, word addr, const void* in, size_t size) {
+    if((unsigned long long)addr + size > VM_MEMORY_SIZE)
+        return false;
+    memcpy(vm->memory + addr, in, size);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "vm.h"
+
+/*
+    ptr2c <image> <output.c>
+
+    Translates an assembled image into C, every instruction becomes a C label
+    and the registers live in locals, so the C compiler sees the whole program.
+    Direct jumps, branches and calls are plain gotos, only `ret` and `jmp_in`
+    go through a switch over every instruction address.
+
+    Build the output against the runtime ( syscalls and externals ) with:
+        gcc out.c -I./include/ -L./build/ -lpointer -lpthread
+    Adding -DPOINTER_AOT_TEST also runs the image on `execute_vm` and checks
+    that both end up with the same registers, memory and output, both read the
+    same stdin ( read up front ) and only the native output is printed.
+*/
+
+#define W sizeof(word)
+
+u8 image[0xFFFF];
+u32 image_size = 0;
+
+// start of every instruction, in order
+u32 starts[0xFFFF];
+u32 starts_size = 0;
+bool is_start[0xFFFF + 1];
+
+word read_word(u32 at) {
+    return *(word*)(image + at);
+}
+
+const char* reg_name(u8 index) {
+    static const char* names[] = { "r0", "r1", "r2", "sp", "bp" };
+    if(index >= sizeof(names)/sizeof(*names)) {
+        printf("ERROR: Unknown register 0x%02X\n", index);
+        exit(1);
+    }
+    return names[index];
+}
+
+// goto the label of a known target, anything else goes through the dispatcher
+// ( `at` is the jump, where the trap goes when the target isn't an instruction )
+void emit_goto(FILE* out, word target, u32 at) {
+    if(target < image_size && is_start[target])
+        fprintf(out, "goto L_%04X;", (u32)target);
+    else
+        fprintf(out, "{ ip = 0x%X; from = 0x%X; goto dispatch; }", (u32)target, at);
+}
+
+// emits a frame operand ( register + offset ) as an address expression
+void emit_frame(FILE* out, u32 at) {
+    fprintf(out, "%s + 0x%X", reg_name(image[at]), (u32)read_word(at + 1));
+}
+
+// the two operands of an alu instruction in `form` ( 0 RR, 1 RC, 2 AA ) as expressions
+void alu_operands(u8 form, u32 at, char* x, char* y) {
+    switch(form) {
+        case 0:
+            sprintf(x, "%s", reg_name(image[at]));
+            sprintf(y, "%s", reg_name(image[at+1]));
+        break;
+        case 1:
+            sprintf(x, "%s", reg_name(image[at]));
+            sprintf(y, "(word)0x%X", (u32)read_word(at+1));
+        break;
+        case 2:
+            sprintf(x, "MEM(0x%X)", (u32)read_word(at));
+            sprintf(y, "MEM(0x%X)", (u32)read_word(at+W));
+        break;
+    }
+}
+
+void emit_instruction(FILE* out, u32 at) {
+    u8 op = image[at];
+    u32 next = at + vm_op_sizes[op];
+    u32 a = at + 1; // first operand
+
+    fprintf(out, "L_%04X: ", at);
+    switch(op) {
+        case OpHlt:
+            fprintf(out, "ip = 0x%X; goto halt;", next);
+        break;
+
+        case OpMoveCA:
+            fprintf(out, "MEM(0x%X) = 0x%X;", (u32)read_word(a+W), (u32)read_word(a));
+        break;
+        case OpMoveCR:
+            fprintf(out, "%s = 0x%X;", reg_name(image[a+W]), (u32)read_word(a));
+        break;
+        case OpMoveAR:
+            fprintf(out, "%s = MEM(0x%X);", reg_name(image[a+W]), (u32)read_word(a));
+        break;
+        case OpMoveRR:
+            fprintf(out, "%s = %s;", reg_name(image[a+1]), reg_name(image[a]));
+        break;
+
+        case OpAddAC:
+            fprintf(out, "r0 = MEM(0x%X) + 0x%X;", (u32)read_word(a), (u32)read_word(a+W));
+        break;
+        case OpAddAA:
+            fprintf(out, "r0 = MEM(0x%X) + MEM(0x%X);", (u32)read_word(a), (u32)read_word(a+W));
+        break;
+        case OpAddRC:
+            fprintf(out, "r0 = %s + 0x%X;", reg_name(image[a]), (u32)read_word(a+1));
+        break;
+
+        case OpEqAA:
+            fprintf(out, "r0 = MEM(0x%X) == MEM(0x%X);", (u32)read_word(a), (u32)read_word(a+W));
+        break;
+
+        case OpPeek:
+            fprintf(out, "MEM(0x%X) = MEM(0x%X);", (u32)read_word(a+W), (u32)read_word(a));
+        break;
+        case OpIf:
+            // skips the instruction that comes next
+            fprintf(out, "if(MEM(0x%X)) ", (u32)read_word(a));
+            emit_goto(out, next + vm_op_sizes[image[next]], at);
+        break;
+        case OpJmp:
+            emit_goto(out, read_word(a), at);
+        break;
+        case OpJmpIn:
+            fprintf(out, "ip = MEM(0x%X); from = 0x%X; goto dispatch;", (u32)read_word(a), at);
+        break;
+
+        case OpPushReg:
+            fprintf(out, "PUSH(%s);", reg_name(image[a]));
+        break;
+        case OpPushAddr:
+            fprintf(out, "PUSH(MEM(0x%X));", (u32)read_word(a));
+        break;
+
+        case OpPopReg:
+            fprintf(out, "sp -= W; %s = MEM(sp);", reg_name(image[a]));
+        break;
+        case OpPopAddr:
+            fprintf(out, "sp -= W; MEM(0x%X) = MEM(sp);", (u32)read_word(a));
+        break;
+
+        case OpPushAddrB:
+            fprintf(out, "mem[sp++] = MEM(0x%X);", (u32)read_word(a));
+        break;
+        case OpPopAddrB:
+            fprintf(out, "MEM(0x%X) = mem[--sp];", (u32)read_word(a));
+        break;
+
+        case OpSyscall:
+            // syscalls can trap ( or halt ), and then nothing after them runs,
+            // an external can also move ip, then it carries on from there
+            fprintf(out, "SAVE(0x%X); vm_syscall(vm); LOAD(); ip = vm->ip; "
+                "if(vm->halted) { if(vm->trap) vm->trap_ip = 0x%X; goto halt; } "
+                "if(ip != 0x%X) { from = 0x%X; goto dispatch; }", next, at, next, at);
+        break;
+
+        case OpReturn:
+            fprintf(out, "sp -= W; ip = MEM(sp); from = 0x%X; goto dispatch;", at);
+        break;
+        case OpCall:
+            fprintf(out, "PUSH(0x%X); ", next);
+            emit_goto(out, read_word(a), at);
+        break;
+        case OpLeave:
+            fprintf(out, "sp = bp - W; bp = MEM(sp);");
+        break;
+
+        case OpEnter:
+            fprintf(out, "PUSH(bp); bp = sp; sp += 0x%X;", (u32)read_word(a));
+        break;
+        case OpMoveCF:
+            fprintf(out, "MEM(");
+            emit_frame(out, a+W);
+            fprintf(out, ") = 0x%X;", (u32)read_word(a));
+        break;
+        case OpMoveFR:
+            fprintf(out, "%s = MEM(", reg_name(image[a+1+W]));
+            emit_frame(out, a);
+            fprintf(out, ");");
+        break;
+        case OpMoveRF:
+            fprintf(out, "MEM(");
+            emit_frame(out, a+1);
+            fprintf(out, ") = %s;", reg_name(image[a]));
+        break;
+        case OpAddFC:
+            fprintf(out, "r0 = MEM(");
+            emit_frame(out, a);
+            fprintf(out, ") + 0x%X;", (u32)read_word(a+1+W));
+        break;
+        case OpPushFrame:
+            fprintf(out, "PUSH(MEM(");
+            emit_frame(out, a);
+            fprintf(out, "));");
+        break;
+        case OpPopFrame:
+            fprintf(out, "{ word addr = ");
+            emit_frame(out, a);
+            fprintf(out, "; sp -= W; MEM(addr) = MEM(sp); }");
+        break;
+
+        case OpJz:
+        case OpJnz:
+            fprintf(out, "if(%sMEM(0x%X)) ", op == OpJz ? "!" : "", (u32)read_word(a));
+            emit_goto(out, read_word(a+W), at);
+        break;
+        case OpJzR:
+        case OpJnzR:
+            fprintf(out, "if(%s%s) ", op == OpJzR ? "!" : "", reg_name(image[a]));
+            emit_goto(out, read_word(a+1), at);
+        break;
+        case OpJeqAA:
+        case OpJltAA:
+        case OpJgtAA:
+            fprintf(out, "if(MEM(0x%X) %s MEM(0x%X)) ", (u32)read_word(a),
+                op == OpJeqAA ? "==" : op == OpJltAA ? "<" : ">", (u32)read_word(a+W));
+            emit_goto(out, read_word(a+W+W), at);
+        break;
+        case OpJeqRR:
+        case OpJltRR:
+        case OpJgtRR:
+            fprintf(out, "if(%s %s %s) ", reg_name(image[a]),
+                op == OpJeqRR ? "==" : op == OpJltRR ? "<" : ">", reg_name(image[a+1]));
+            emit_goto(out, read_word(a+2), at);
+        break;
+
+        case OpAddRR:
+            fprintf(out, "r0 = %s + %s;", reg_name(image[a]), reg_name(image[a+1]));
+        break;
+        case OpDivRR:
+        case OpDivRC:
+        case OpDivAA: {
+            char x[32], y[32];
+            alu_operands(op - OpDivRR, a, x, y);
+            fprintf(out, "{ word a = %s, b = %s; if(!b) { ip = 0x%X; vm_trap(vm, TrapDivideByZero); "
+                "vm->trap_ip = 0x%X; goto halt; } r0 = a / b; r1 = a %% b; }", x, y, next, at);
+        } break;
+        case OpNotR:
+            fprintf(out, "r0 = ~%s;", reg_name(image[a]));
+        break;
+        case OpNotA:
+            fprintf(out, "r0 = ~MEM(0x%X);", (u32)read_word(a));
+        break;
+
+        default:
+            if(op >= OpSubRR && op <= OpLtsAA) {
+                char x[32], y[32];
+                alu_operands(VM_ALU_FORM(op), a, x, y);
+                // vm_alu is inline, with a constant op the compiler folds it into one operator
+                fprintf(out, "r0 = vm_alu(%d, %s, %s);", VM_ALU_OP(op), x, y);
+                break;
+            }
+            printf("ERROR: Unknown opcode 0x%02X at 0x%04X\n", op, at);
+            exit(1);
+        break;
+    }
+    fputc('\n', out);
+}
+
+int main(int argc, char** argv) {
+    if(argc < 3) {
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[1], "rb");
+    if(!fp) {
+        printf("ERROR: Couldn't open file %s\n", argv[1]);
+        return 1;
+    }
+    fread(image, sizeof(*image), sizeof(image), fp);
+    fclose(fp);
+
+    // the image is padded with zeros ( hlt ), only keep up to the last real byte
+    image_size = sizeof(image);
+    while(image_size && !image[image_size-1])
+        --image_size;
+
+    u32 at = 0;
+    while(at < image_size) {
+        u8 op = image[at];
+        if(op >= OpCount || !vm_op_sizes[op]) {
+            printf("ERROR: Unknown opcode 0x%02X at 0x%04X\n", op, at);
+            return 1;
+        }
+        starts[starts_size++] = at;
+        is_start[at] = true;
+        at += vm_op_sizes[op];
+    }
+    // everything after the image is hlt
+    starts[starts_size++] = at;
+    is_start[at] = true;
+    image_size = at + 1;
+
+    FILE* out = fopen(argv[2], "wb");
+    if(!out) {
+        printf("ERROR: Couldn't open file %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "// generated by ptr2c from %s\n", argv[1]);
+    fprintf(out, "#include <string.h>\n\n#include \"vm.h\"\n\n");
+    fprintf(out, "#define W sizeof(word)\n");
+    fprintf(out, "#define MEM(addr) (*(word*)(mem + (word)(addr)))\n");
+    fprintf(out, "#define PUSH(value) do { word v = (value); MEM(sp) = v; sp += W; } while(0)\n");
+    fprintf(out, "#define SAVE(next) do { vm->r[0] = r0; vm->r[1] = r1; vm->r[2] = r2; "
+                 "vm->sp = sp; vm->bp = bp; vm->ip = next; } while(0)\n");
+    fprintf(out, "#define LOAD() do { r0 = vm->r[0]; r1 = vm->r[1]; r2 = vm->r[2]; "
+                 "sp = vm->sp; bp = vm->bp; } while(0)\n\n");
+
+    fprintf(out, "static const u8 image[0x%X] = {", image_size);
+    for(u32 i = 0; i < image_size; ++i)
+        fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", image[i]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "void run_native(vm_t* vm) {\n");
+    fprintf(out, "u8* mem = vm->memory;\n");
+    fprintf(out, "word r0, r1, r2, sp, bp;\n");
+    fprintf(out, "word ip = vm->ip;\n");
+    fprintf(out, "word from = ip; // what jumped to ip, for the trap when it isn't an instruction\n");
+    fprintf(out, "LOAD();\n");
+    fprintf(out, "goto dispatch;\n\n");
+
+    for(u32 i = 0; i < starts_size; ++i)
+        emit_instruction(out, starts[i]);
+
+    fprintf(out, "\ndispatch:\nswitch(ip) {\n");
+    for(u32 i = 0; i < starts_size; ++i)
+        fprintf(out, "case 0x%X: goto L_%04X;\n", starts[i], starts[i]);
+    fprintf(out, "}\n");
+    // past the image it's all hlt, ret and jmp_in landing anywhere else trap like in the interpreter
+    fprintf(out, "if(ip > 0x%X && (u32)ip + VM_MAX_OP_SIZE <= sizeof(vm->data)) { ip += 1; goto halt; }\n",
+        starts[starts_size-1]);
+    fprintf(out, "vm_trap(vm, TrapBadJump);\nvm->trap_ip = from;\n");
+    fprintf(out, "halt:\nSAVE(ip);\nvm->halted = true;\n}\n\n");
+
+    fprintf(out,
+        "int main(void) {\n"
+        "    vm_t* vm = calloc(1, sizeof(vm_t));\n"
+        "    if(!vm_init(vm))\n"
+        "        return 1;\n"
+        "    memcpy(vm->data, image, sizeof(image));\n"
+        "#ifdef POINTER_AOT_TEST\n"
+        "    vm_t* ref = calloc(1, sizeof(vm_t));\n"
+        "    if(!vm_init(ref))\n"
+        "        return 1;\n"
+        "    memcpy(ref->data, image, sizeof(image));\n"
+        "    // it runs the way ptr runs it, unchecked when it verifies\n"
+        "    vm_verify(ref, NULL);\n"
+        "\n"
+        "    // both sides get the same input and their own output\n"
+        "    vm_io io = {0}, ref_io = {0};\n"
+        "    u8* in = NULL;\n"
+        "    u32 in_size = 0, in_capacity = 0;\n"
+        "    for(int c; (c = getchar()) != EOF; in[in_size++] = c)\n"
+        "        if(in_size == in_capacity && !(in = realloc(in, in_capacity = in_capacity ? in_capacity * 2 : 0x100)))\n"
+        "            return 1;\n"
+        "    io.in = ref_io.in = in;\n"
+        "    io.in_size = ref_io.in_size = in_size;\n"
+        "    vm->io = &io;\n"
+        "    ref->io = &ref_io;\n"
+        "    execute_vm(ref);\n"
+        "#endif\n"
+        "    run_native(vm);\n"
+        "#ifdef POINTER_AOT_TEST\n"
+        "    fwrite(io.out, 1, io.out_size, stdout);\n"
+        "#endif\n"
+        "    if(vm->trap)\n"
+        "        printf(\"ERROR: trapped, %%s at 0x%%04X\\n\", vm_trap_names[vm->trap], (u32)vm->trap_ip);\n"
+        "#ifdef POINTER_AOT_TEST\n"
+        "    bool same = true;\n"
+        "    for(u8 i = 0; i < 3; ++i)\n"
+        "        same &= vm->r[i] == ref->r[i];\n"
+        "    same &= vm->sp == ref->sp && vm->bp == ref->bp && vm->ip == ref->ip;\n"
+        "    same &= vm->trap == ref->trap && (!vm->trap || vm->trap_ip == ref->trap_ip);\n"
+        "    same &= !memcmp(vm->memory, ref->memory, VM_MEMORY_SIZE);\n"
+        "    same &= io.out_size == ref_io.out_size && !memcmp(io.out, ref_io.out, io.out_size);\n"
+        "    printf(\"aot: %%s\\n\", same ? \"OK\" : \"MISMATCH\");\n"
+        "    if(!same) {\n"
+        "        printf(\"native: r0 = 0x%%X, r1 = 0x%%X, r2 = 0x%%X, sp = 0x%%X, bp = 0x%%X, ip = 0x%%X, %%u bytes out\\n\",\n"
+        "            (u32)vm->r[0], (u32)vm->r[1], (u32)vm->r[2], (u32)vm->sp, (u32)vm->bp, (u32)vm->ip, io.out_size);\n"
+        "        printf(\"vm:     r0 = 0x%%X, r1 = 0x%%X, r2 = 0x%%X, sp = 0x%%X, bp = 0x%%X, ip = 0x%%X, %%u bytes out\\n\",\n"
+        "            (u32)ref->r[0], (u32)ref->r[1], (u32)ref->r[2], (u32)ref->sp, (u32)ref->bp, (u32)ref->ip, ref_io.out_size);\n"
+        "        return 1;\n"
+        "    }\n"
+        "#endif\n"
+        "    return 0;\n"
+        "}\n");
+
+    fclose(out);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "vm.h"
+#include "trace.h"
+
+/*
+    ptrtrace <file>
+
+    Decodes a trace recorded with `ptr --trace <file>` into one line per
+    executed instruction: ip, opcode, raw operand bytes and the registers
+    the instruction changed.
+*/
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[1], "rb");
+    if(!fp) {
+        printf("ERROR: Couldn't open file %s\n", argv[1]);
+        return 1;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    char magic[4];
+    int word_size = 0;
+    if(fread(magic, 1, 4, fp) != 4 || memcmp(magic, TRACE_MAGIC, 4) ||
+        (word_size = fgetc(fp)) == EOF) {
+        printf("ERROR: %s is not a trace file\n", argv[1]);
+        return 1;
+    }
+    if(word_size != sizeof(word)) {
+        printf("ERROR: The trace has %d byte words, this ptrtrace was built for %d\n",
+            word_size, (int)sizeof(word));
+        return 1;
+    }
+
+    static const char* names[TRACE_REGS] = { "r0", "r1", "r2", "rsp", "rbp" };
+    unsigned long long count = 0;
+
+    word ip;
+    while(fread(&ip, sizeof(word), 1, fp) == 1) {
+        int op = fgetc(fp);
+        if(op == EOF || op >= OpCount || !vm_op_sizes[op]) {
+            printf("ERROR: Bad opcode in record %llu\n", count);
+            return 1;
+        }
+
+        u8 operands[TRACE_OPERANDS];
+        u8 operands_size = vm_op_sizes[op] - 1;
+        int changed;
+        if(fread(operands, 1, operands_size, fp) != operands_size ||
+            (changed = fgetc(fp)) == EOF) {
+            printf("ERROR: Truncated record %llu\n", count);
+            return 1;
+        }
+
+        printf("0x%04X  %-8s", (u32)ip, vm_op_names[op]);
+        for(u8 i = 0; i < TRACE_OPERANDS; ++i) {
+            if(i < operands_size)
+                printf(" %02X", operands[i]);
+            else
+                printf("   ");
+        }
+        printf(" |");
+
+        for(u8 i = 0; i < TRACE_REGS; ++i) {
+            if(!(changed & (1 << i)))
+                continue;
+            word value;
+            if(fread(&value, sizeof(word), 1, fp) != 1) {
+                printf("\nERROR: Truncated record %llu\n", count);
+                return 1;
+            }
+            printf(" %s = 0x%04X", names[i], (u32)value);
+        }
+        putchar('\n');
+        ++count;
+    }
+
+    printf("%llu instructions\n", count);
+    fclose(fp);
+    return 0;
+}
\ No newline at end of file
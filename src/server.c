@@ -0,0 +1,262 @@
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "server.h"
+
+#define SERVER_FLUSH 0x10000 // responses waiting before they get sent anyway
+
+#ifdef _WIN32
+
+bool server_run(const char* socket_path, const vm_t* images, int images_size, int warm,
+    unsigned long long budget) {
+    printf("ERROR: Server mode needs unix domain sockets\n");
+    return false;
+}
+
+#else
+
+typedef struct pool pool;
+typedef struct server server;
+typedef struct connection connection;
+typedef struct buffer buffer;
+
+// the VMs of one image that aren't running anything
+struct pool {
+    const vm_t* image;
+    pthread_mutex_t lock;
+    vm_t** ready;
+    int ready_size;
+    int ready_capacity;
+};
+
+struct server {
+    pool* pools;
+    int pools_size;
+    unsigned long long budget;  // instructions every request gets
+};
+
+struct connection {
+    server* s;
+    int fd;
+};
+
+struct buffer {
+    u8* data;
+    u32 size;
+    u32 capacity;
+};
+
+static bool buffer_reserve(buffer* b, u32 more) {
+    if(b->capacity - b->size >= more)
+        return true;
+    u32 capacity = b->capacity ? b->capacity : 0x1000;
+    while(capacity - b->size < more)
+        capacity *= 2;
+    u8* data = realloc(b->data, capacity);
+    if(!data)
+        return false;
+    b->data = data;
+    b->capacity = capacity;
+    return true;
+}
+
+static bool buffer_append(buffer* b, const void* data, u32 size) {
+    if(!buffer_reserve(b, size))
+        return false;
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+    return true;
+}
+
+static bool send_all(int fd, buffer* b) {
+    for(u32 at = 0; at < b->size;) {
+        ssize_t sent = send(fd, b->data + at, b->size - at, 0);
+        if(sent < 0 && errno == EINTR)
+            continue;
+        if(sent <= 0)
+            return false;
+        at += sent;
+    }
+    b->size = 0;
+    return true;
+}
+
+static vm_t* pool_make(pool* p) {
+    vm_t* vm = calloc(1, sizeof(vm_t));
+    if(!vm)
+        return NULL;
+    if(!vm_init(vm)) {
+        free(vm);
+        return NULL;
+    }
+    // already verified once, every copy of the image runs the same way
+    memcpy(vm->data, p->image->data, sizeof(vm->data));
+    memcpy(vm->starts, p->image->starts, sizeof(vm->starts));
+    vm->verified = p->image->verified;
+    return vm;
+}
+
+static vm_t* pool_take(pool* p) {
+    pthread_mutex_lock(&p->lock);
+    vm_t* vm = p->ready_size ? p->ready[--p->ready_size] : NULL;
+    pthread_mutex_unlock(&p->lock);
+    return vm ? vm : pool_make(p);
+}
+
+static void pool_give(pool* p, vm_t* vm) {
+    vm_reset(vm);
+    pthread_mutex_lock(&p->lock);
+    if(p->ready_size == p->ready_capacity) {
+        int capacity = p->ready_capacity ? p->ready_capacity * 2 : 8;
+        vm_t** ready = realloc(p->ready, sizeof(vm_t*) * capacity);
+        if(!ready) {
+            pthread_mutex_unlock(&p->lock);
+            vm_destroy(vm);
+            free(vm);
+            return;
+        }
+        p->ready = ready;
+        p->ready_capacity = capacity;
+    }
+    p->ready[p->ready_size++] = vm;
+    pthread_mutex_unlock(&p->lock);
+}
+
+// runs every request that came in on the connection, in order
+static void* connection_run(void* arg) {
+    connection c = *(connection*)arg;
+    free(arg);
+
+    buffer in = {0}, out = {0};
+    vm_io io = {0};
+    u32 at = 0; // first request that didn't run yet
+
+    for(;;) {
+        while(in.size - at >= 2 * sizeof(u32)) {
+            u32 request[2];
+            memcpy(request, in.data + at, sizeof(request));
+            if(request[1] > SERVER_MAX_INPUT)
+                goto done;
+            if(in.size - at - sizeof(request) < request[1])
+                break;
+
+            u32 response[3] = { SERVER_BAD_IMAGE, 0, 0 };
+            io.out_size = 0;
+            if(request[0] < (u32)c.s->pools_size) {
+                pool* p = &c.s->pools[request[0]];
+                vm_t* vm = pool_take(p);
+                if(!vm)
+                    goto done;
+                // straight from the receive buffer, no copies
+                io.in = in.data + at + sizeof(request);
+                io.in_size = request[1];
+                io.in_at = 0;
+                vm->io = &io;
+                vm->budget = c.s->budget;
+                execute_vm(vm);
+                vm->io = NULL;
+                response[0] = vm->trap;
+                response[1] = vm->trap_ip;
+                response[2] = io.out_size;
+                pool_give(p, vm);
+            }
+            if(!buffer_append(&out, response, sizeof(response)) || !buffer_append(&out, io.out, io.out_size))
+                goto done;
+            at += sizeof(request) + request[1];
+
+            if(out.size >= SERVER_FLUSH && !send_all(c.fd, &out))
+                goto done;
+        }
+
+        // nothing complete left to run, send what's done before waiting for more
+        if(!send_all(c.fd, &out))
+            goto done;
+        memmove(in.data, in.data + at, in.size - at);
+        in.size -= at;
+        at = 0;
+
+        if(!buffer_reserve(&in, 0x10000))
+            goto done;
+        ssize_t got = recv(c.fd, in.data + in.size, in.capacity - in.size, 0);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got <= 0)
+            goto done;
+        in.size += got;
+    }
+
+done:
+    close(c.fd);
+    free(in.data);
+    free(out.data);
+    free(io.out);
+    return NULL;
+}
+
+bool server_run(const char* socket_path, const vm_t* images, int images_size, int warm,
+    unsigned long long budget) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("ERROR: Socket path %s is too long\n", socket_path);
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 64)) {
+        printf("ERROR: Couldn't listen on %s\n", socket_path);
+        if(fd >= 0)
+            close(fd);
+        return false;
+    }
+    // a client that goes away mid response shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    server s = { calloc(images_size, sizeof(pool)), images_size, budget };
+    for(int i = 0; i < images_size; ++i) {
+        pool* p = &s.pools[i];
+        p->image = &images[i];
+        pthread_mutex_init(&p->lock, NULL);
+        for(int w = 0; w < warm; ++w) {
+            vm_t* vm = pool_make(p);
+            if(vm)
+                pool_give(p, vm);
+        }
+    }
+
+    // one thread per connection, requests on a connection run one after the other
+    for(;;) {
+        int client = accept(fd, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            printf("ERROR: Couldn't accept on %s\n", socket_path);
+            break;
+        }
+        connection* c = malloc(sizeof(connection));
+        pthread_t thread;
+        if(!c) {
+            close(client);
+            continue;
+        }
+        *c = (connection){ &s, client };
+        if(pthread_create(&thread, NULL, connection_run, c)) {
+            close(client);
+            free(c);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(fd);
+    return false;
+}
+
+#endif
\ No newline at end of file
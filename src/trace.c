@@ -0,0 +1,188 @@
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stddef.h>
+
+#include "trace.h"
+
+// ip, op, operands, changed mask and every register
+#define TRACE_RECORD_MAX (sizeof(word) + 1 + TRACE_OPERANDS + 1 + TRACE_REGS * sizeof(word))
+#define TRACE_ENTRIES    (1 << 18)  // raw entries in the ring, must be a power of 2
+#define TRACE_PUBLISH    (1 << 10)  // the VM only tells the writer about new entries this often
+#define TRACE_CHUNK      (1 << 16)  // bytes the writer encodes before handing them to fwrite
+
+// trace_record copies r0, r1, r2, sp and bp in one go
+_Static_assert(offsetof(vm_t, bp) == offsetof(vm_t, r) + 4 * sizeof(word), "registers aren't next to each other");
+
+// what the VM leaves for every instruction, the registers after it ran
+// ( the ones before it are the ones after the entry before )
+typedef struct {
+    word ip;
+    word regs[TRACE_REGS];
+    bool begin;     // not an instruction, the registers execute_vm started with
+} trace_entry;
+
+/*
+    The VM only copies its registers into the ring, the writer thread turns
+    them into records ( working out what changed ) and hands big chunks of
+    those to fwrite, so the VM pays a few stores per instruction.
+*/
+struct trace {
+    FILE* fp;
+    pthread_t writer;
+    atomic_bool stop;
+    const u8* data;             // image of the VM being traced, set by trace_begin
+    u8 operands[0x100];         // operand bytes of every opcode, 0 for the ones that don't exist
+    size_t tail_cache;          // producer's last look at tail, saves an atomic load per record
+    size_t head_local;          // producer's head, only goes to `head` every TRACE_PUBLISH entries
+    _Alignas(64) atomic_size_t head; // written by the VM
+    _Alignas(64) atomic_size_t tail; // written by the writer thread
+    trace_entry ring[TRACE_ENTRIES];
+    u8 chunk[TRACE_CHUNK + TRACE_RECORD_MAX]; // the writer's records on their way to fwrite
+};
+
+// encodes one record into `p` the way it goes on the file, returns its end
+static u8* trace_encode(trace* t, const trace_entry* e, const word* before, u8* p) {
+    u8 op = t->data[e->ip];
+    u8 operands = t->operands[op];
+    memcpy(p, &e->ip, sizeof(word));
+    p += sizeof(word);
+    *p++ = op;
+
+    // not past the end of the image
+    u32 left = sizeof(((vm_t*)0)->data) - e->ip - 1;
+    if(left > operands)
+        left = operands;
+    memcpy(p, t->data + e->ip + 1, left);
+    memset(p + left, 0, operands - left);
+    p += operands;
+
+    u8* changed = p++;
+    u8 mask = 0;
+    for(u8 i = 0; i < TRACE_REGS; ++i) {
+        if(e->regs[i] == before[i])
+            continue;
+        memcpy(p, &e->regs[i], sizeof(word));
+        p += sizeof(word);
+        mask |= 1 << i;
+    }
+    *changed = mask;
+    return p;
+}
+
+static void* trace_writer(void* arg) {
+    trace* t = arg;
+    size_t tail = 0;
+    word regs[TRACE_REGS] = {0};
+    u8* chunk = t->chunk;
+
+    for(;;) {
+        // look at stop before head, so nothing pushed before stopping is missed
+        bool stopping = atomic_load_explicit(&t->stop, memory_order_acquire);
+        size_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+
+        if(head == tail) {
+            if(stopping)
+                break;
+            struct timespec nap = { 0, 50000 };
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        u8* p = chunk;
+        for(; tail != head; ++tail) {
+            const trace_entry* e = &t->ring[tail & (TRACE_ENTRIES-1)];
+            if(!e->begin)
+                p = trace_encode(t, e, regs, p);
+            memcpy(regs, e->regs, sizeof(regs));
+
+            if(p - chunk >= TRACE_CHUNK) {
+                fwrite(chunk, 1, p - chunk, t->fp);
+                p = chunk;
+                // let the VM have the room back already
+                atomic_store_explicit(&t->tail, tail + 1, memory_order_release);
+            }
+        }
+        fwrite(chunk, 1, p - chunk, t->fp);
+        atomic_store_explicit(&t->tail, tail, memory_order_release);
+    }
+
+    fflush(t->fp);
+    return NULL;
+}
+
+trace* trace_start(const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if(!fp) {
+        printf("ERROR: Couldn't open file %s\n", path);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    fwrite(TRACE_MAGIC, 1, 4, fp);
+    fputc(sizeof(word), fp);
+
+    trace* t = vm_aligned_alloc(64, sizeof(trace));
+    if(!t) {
+        printf("ERROR: Couldn't allocate the trace ring\n");
+        fclose(fp);
+        return NULL;
+    }
+    t->fp = fp;
+    t->data = NULL;
+    t->tail_cache = 0;
+    t->head_local = 0;
+    for(u32 op = 0; op < 0x100; ++op)
+        t->operands[op] = op < OpCount && vm_op_sizes[op] ? vm_op_sizes[op] - 1 : 0;
+    atomic_init(&t->stop, false);
+    atomic_init(&t->head, 0);
+    atomic_init(&t->tail, 0);
+
+    pthread_create(&t->writer, NULL, trace_writer, t);
+    return t;
+}
+
+void trace_stop(trace* t) {
+    atomic_store_explicit(&t->head, t->head_local, memory_order_release);
+    atomic_store_explicit(&t->stop, true, memory_order_release);
+    pthread_join(t->writer, NULL);
+    fclose(t->fp);
+    vm_aligned_free(t);
+}
+
+// full, wait for the writer to catch up ( telling it about everything first )
+static void trace_wait(trace* t, size_t head) {
+    atomic_store_explicit(&t->head, head, memory_order_release);
+    for(;;) {
+        t->tail_cache = atomic_load_explicit(&t->tail, memory_order_acquire);
+        if(head - t->tail_cache < TRACE_ENTRIES)
+            break;
+        sched_yield();
+    }
+}
+
+static inline void trace_push(trace* t, vm_t* vm, word ip, bool begin) {
+    size_t head = t->head_local;
+    if(head - t->tail_cache >= TRACE_ENTRIES)
+        trace_wait(t, head);
+
+    trace_entry* e = &t->ring[head & (TRACE_ENTRIES-1)];
+    e->ip = ip;
+    memcpy(e->regs, vm->r, sizeof(e->regs));
+    e->begin = begin;
+
+    t->head_local = ++head;
+    if(!(head & (TRACE_PUBLISH-1)))
+        atomic_store_explicit(&t->head, head, memory_order_release);
+}
+
+void trace_begin(trace* t, vm_t* vm) {
+    t->data = vm->data;
+    trace_push(t, vm, vm->ip, true);
+}
+
+void trace_record(trace* t, vm_t* vm, word ip) {
+    trace_push(t, vm, ip, false);
+}
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include <string.h>
+
+#include "vm.h"
+
+/*
+    The verifier runs in two passes over vm->data:
+
+    1. a linear sweep that decodes every instruction and checks opcodes,
+       register indices, static memory operands and jump/call targets
+    2. an abstract run of the program that follows the exact value of rsp
+       and rbp ( and of *0x00, to know which syscall a `sys` is ) through
+       every path, calls included, to find the highest rsp the program can
+       reach, it gives up on anything it can't follow ( jmp_in, recursion,
+       rsp written from memory, a loop that moves rsp, ... )
+
+    Only when both pass the image runs without runtime checks.
+*/
+
+#define W sizeof(word)
+
+#define VERIFY_MAX_CALLS 64         // deepest call chain followed
+#define VERIFY_MAX_STEPS 0x100000   // instructions visited before giving up
+
+enum known_flags {
+    KnownSp    = 1 << 0,
+    KnownBp    = 1 << 1,
+    KnownSn    = 1 << 2,    // *0x00
+    HasFrame   = 1 << 3,    // an enter ran in this call
+    KnownSaved = 1 << 4,    // the rbp that enter pushed
+};
+
+typedef struct stack_state stack_state;
+typedef struct verifier verifier;
+
+struct stack_state {
+    u8 known;
+    word sp;
+    word bp;
+    word sn;
+    word saved_bp;
+};
+
+struct verifier {
+    vm_t* vm;
+    vm_verify_report* report;
+    u32 code_size;              // everything past it is zeros ( hlt )
+    bool is_start[0xFFFF];
+    word calls[VERIFY_MAX_CALLS];
+    u32 calls_size;
+    u32 steps;
+    word stack_max;
+};
+
+static bool verify_fail(verifier* v, word ip, const char* error) {
+    if(v->report && !v->report->error) {
+        v->report->error = error;
+        v->report->error_ip = ip;
+    }
+    return false;
+}
+
+static bool verify_target(verifier* v, word target) {
+    if(target < v->code_size)
+        return v->is_start[target];
+    // past the code there is only hlt, as long as it is inside of the image
+    return target < sizeof(v->vm->data);
+}
+
+static bool verify_code(verifier* v) {
+    vm_t* vm = v->vm;
+
+    v->code_size = sizeof(vm->data);
+    while(v->code_size && !vm->data[v->code_size-1])
+        --v->code_size;
+
+    // first find where every instruction starts
+    u32 ip = 0;
+    while(ip < v->code_size) {
+        u8 op = vm->data[ip];
+        if(op >= OpCount || !vm_op_sizes[op])
+            return verify_fail(v, ip, "unknown opcode");
+        if(ip + vm_op_sizes[op] > sizeof(vm->data))
+            return verify_fail(v, ip, "instruction runs past the end of the image");
+        v->is_start[ip] = true;
+        ip += vm_op_sizes[op];
+    }
+    v->code_size = ip;
+
+    // then check their operands
+    for(ip = 0; ip < v->code_size; ip += vm_op_sizes[vm->data[ip]]) {
+        u32 at = ip + 1;
+        for(const char* kind = vm_op_operands[vm->data[ip]]; *kind; ++kind) {
+            switch(*kind) {
+                case 'c':
+                    at += W;
+                break;
+                case 'a': {
+                    word addr = *(word*)(vm->data + at);
+                    if((unsigned long long)addr + W > VM_MEMORY_SIZE)
+                        return verify_fail(v, ip, "memory operand out of range");
+                    at += W;
+                } break;
+                case 't': {
+                    if(!verify_target(v, *(word*)(vm->data + at)))
+                        return verify_fail(v, ip, "jump into the middle of an instruction");
+                    at += W;
+                } break;
+                case 'r':
+                    if(vm->data[at++] >= VM_REGISTERS)
+                        return verify_fail(v, ip, "unknown register");
+                break;
+                case 'f':
+                    if(vm->data[at++] >= VM_REGISTERS)
+                        return verify_fail(v, ip, "unknown register");
+                    at += W;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+static bool stack_push(verifier* v, stack_state* s, word ip, word size) {
+    if((unsigned long long)s->sp + size > VM_STACK_SIZE)
+        return verify_fail(v, ip, "stack overflow");
+    // pushing over *0x00 changes the syscall number
+    if(s->sp < W)
+        s->known &= ~KnownSn;
+    s->sp += size;
+    if(s->sp > v->stack_max)
+        v->stack_max = s->sp;
+    return true;
+}
+
+static bool stack_pop(verifier* v, stack_state* s, word ip, word size) {
+    if(s->sp < size)
+        return verify_fail(v, ip, "stack underflow");
+    s->sp -= size;
+    return true;
+}
+
+// a word gets written to `addr`, keep track of *0x00
+static void stack_write(stack_state* s, bool addr_known, word addr, bool value_known, word value) {
+    if(!addr_known) {
+        s->known &= ~KnownSn;
+    } else if(addr == 0 && value_known) {
+        s->known |= KnownSn;
+        s->sn = value;
+    } else if(addr < W || (addr > (word)-W)) {
+        s->known &= ~KnownSn;
+    }
+}
+
+static bool stack_set_register(verifier* v, stack_state* s, word ip, u8 index, bool known, word value) {
+    if(index == 0x03) {
+        if(!known)
+            return verify_fail(v, ip, "rsp gets a value that isn't known");
+        s->sp = value;
+        if(s->sp > VM_STACK_SIZE)
+            return verify_fail(v, ip, "rsp outside of the stack");
+        if(s->sp > v->stack_max)
+            v->stack_max = s->sp;
+    } else if(index == 0x04) {
+        s->known = known ? s->known | KnownBp : s->known & ~KnownBp;
+        s->bp = value;
+    }
+    return true;
+}
+
+// address of a frame operand, when its register is rsp or rbp and known
+static bool stack_frame(stack_state* s, u8* operand, word* addr) {
+    word offset = *(word*)(operand + 1);
+    if(*operand == 0x03) {
+        *addr = s->sp + offset;
+        return true;
+    }
+    if(*operand == 0x04 && (s->known & KnownBp)) {
+        *addr = s->bp + offset;
+        return true;
+    }
+    return false;
+}
+
+static bool stack_equal(stack_state* a, stack_state* b) {
+    return a->known == b->known && a->sp == b->sp &&
+        (!(a->known & KnownBp) || a->bp == b->bp) &&
+        (!(a->known & KnownSn) || a->sn == b->sn) &&
+        (!(a->known & KnownSaved) || a->saved_bp == b->saved_bp);
+}
+
+typedef struct stack_work stack_work;
+
+struct stack_work {
+    word ip;
+    stack_state state;
+};
+
+// follows one call of the routine at `entry`, `out` gets the state at its
+// `ret` ( the top level has no caller, so it must end in hlt )
+static bool verify_stack(verifier* v, word entry, stack_state in, stack_state* out) {
+    vm_t* vm = v->vm;
+
+    if(v->calls_size >= VERIFY_MAX_CALLS)
+        return verify_fail(v, entry, "calls nested too deep to follow");
+    for(u32 i = 0; i < v->calls_size; ++i)
+        if(v->calls[i] == entry)
+            return verify_fail(v, entry, "recursive call");
+    v->calls[v->calls_size++] = entry;
+
+    bool ok = true;
+    bool returned = false;
+    stack_state* seen = calloc(v->code_size + 1, sizeof(stack_state));
+    bool* visited = calloc(v->code_size + 1, sizeof(bool));
+    stack_work* work = malloc(sizeof(stack_work) * (v->code_size + 1) * 2);
+    u32 work_size = 0;
+
+    if(!seen || !visited || !work)
+        ok = verify_fail(v, entry, "out of memory");
+    else
+        work[work_size++] = (stack_work){ entry, in };
+
+    while(ok && work_size) {
+        stack_work w = work[--work_size];
+        word ip = w.ip;
+        stack_state s = w.state;
+
+        // past the code everything is hlt, as long as it is inside of the image
+        if(ip >= sizeof(vm->data)) {
+            ok = verify_fail(v, ip, "runs past the end of the image");
+            break;
+        }
+        if(ip >= v->code_size)
+            continue;
+
+        if(visited[ip]) {
+            if(!stack_equal(&seen[ip], &s))
+                ok = verify_fail(v, ip, "stack changes between two paths that meet");
+            continue;
+        }
+        visited[ip] = true;
+        seen[ip] = s;
+
+        if(++v->steps > VERIFY_MAX_STEPS) {
+            ok = verify_fail(v, ip, "program too big to follow");
+            break;
+        }
+
+        u8 op = vm->data[ip];
+        u8* a = vm->data + ip + 1;
+        word next = ip + vm_op_sizes[op];
+        bool falls = true;  // whether `next` runs after this one
+
+        switch(op) {
+            case OpHlt:
+                falls = false;
+            break;
+
+            case OpMoveCA:
+                stack_write(&s, true, *(word*)(a + W), true, *(word*)a);
+            break;
+            case OpMoveCR:
+                ok = stack_set_register(v, &s, ip, a[W], true, *(word*)a);
+            break;
+            case OpMoveAR:
+                ok = stack_set_register(v, &s, ip, a[W], false, 0);
+            break;
+            case OpMoveRR: {
+                bool known = (a[0] == 0x03) || (a[0] == 0x04 && (s.known & KnownBp));
+                word value = a[0] == 0x03 ? s.sp : s.bp;
+                ok = stack_set_register(v, &s, ip, a[1], known, value);
+            } break;
+            case OpPeek:
+                stack_write(&s, true, *(word*)(a + W), false, 0);
+            break;
+
+            case OpPushReg:
+            case OpPushAddr:
+            case OpPushFrame:
+                ok = stack_push(v, &s, ip, W);
+            break;
+            case OpPushAddrB:
+                ok = stack_push(v, &s, ip, 1);
+            break;
+            case OpPopReg:
+                ok = stack_pop(v, &s, ip, W) &&
+                    stack_set_register(v, &s, ip, a[0], false, 0);
+            break;
+            case OpPopAddr:
+                ok = stack_pop(v, &s, ip, W);
+                stack_write(&s, true, *(word*)a, false, 0);
+            break;
+            case OpPopAddrB:
+                ok = stack_pop(v, &s, ip, 1);
+                stack_write(&s, true, *(word*)a, false, 0);
+            break;
+            case OpPopFrame: {
+                word addr;
+                bool known = stack_frame(&s, a, &addr);
+                ok = stack_pop(v, &s, ip, W);
+                stack_write(&s, known, addr, false, 0);
+            } break;
+
+            case OpMoveCF: {
+                word addr;
+                bool known = stack_frame(&s, a + W, &addr);
+                stack_write(&s, known, addr, true, *(word*)a);
+            } break;
+            case OpMoveFR:
+                ok = stack_set_register(v, &s, ip, a[1 + W], false, 0);
+            break;
+            case OpMoveRF: {
+                word addr;
+                bool known = stack_frame(&s, a + 1, &addr);
+                stack_write(&s, known, addr, false, 0);
+            } break;
+
+            case OpEnter:
+                if(s.known & HasFrame) {
+                    ok = verify_fail(v, ip, "more than one enter in the same call");
+                    break;
+                }
+                s.saved_bp = s.bp;
+                s.known = (s.known & KnownBp) ? s.known | KnownSaved : s.known & ~KnownSaved;
+                s.known |= HasFrame;
+                ok = stack_push(v, &s, ip, W);
+                s.bp = s.sp;
+                s.known |= KnownBp;
+                ok = ok && stack_push(v, &s, ip, *(word*)a);
+            break;
+            case OpLeave:
+                if(!(s.known & KnownBp)) {
+                    ok = verify_fail(v, ip, "leave with an unknown rbp");
+                    break;
+                }
+                ok = stack_set_register(v, &s, ip, 0x03, true, s.bp) &&
+                    stack_pop(v, &s, ip, W);
+                s.bp = s.saved_bp;
+                s.known = (s.known & HasFrame) && (s.known & KnownSaved) ?
+                    s.known | KnownBp : s.known & ~KnownBp;
+                s.known &= ~(HasFrame | KnownSaved);
+            break;
+
+            case OpSyscall: {
+                if(!(s.known & KnownSn) || s.sn >= VM_SYSCALLS) {
+                    ok = verify_fail(v, ip, "syscall number not known");
+                    break;
+                }
+                const vm_syscall_effect* e = &vm_syscall_effects[s.sn];
+                if(e->unknown) {
+                    ok = verify_fail(v, ip, "external function call");
+                    break;
+                }
+                ok = stack_pop(v, &s, ip, e->pops) && stack_push(v, &s, ip, e->pushes);
+                if(e->writes_memory)
+                    s.known &= ~KnownSn;
+            } break;
+
+            case OpCall: {
+                stack_state callee = s;
+                callee.known &= ~(HasFrame | KnownSaved);
+                if(!(ok = stack_push(v, &callee, ip, W)))
+                    break;
+                // the return address overwrote *0x00
+                s.known = (s.known & ~KnownSn) | (callee.known & KnownSn);
+
+                stack_state back;
+                if(!(ok = verify_stack(v, *(word*)a, callee, &back)))
+                    break;
+                // the caller's frame is still the caller's
+                back.known = (back.known & ~(HasFrame | KnownSaved)) | (s.known & (HasFrame | KnownSaved));
+                back.saved_bp = s.saved_bp;
+                s = back;
+            } break;
+
+            case OpReturn:
+                falls = false;
+                if(v->calls_size == 1) {
+                    ok = verify_fail(v, ip, "ret without a call");
+                    break;
+                }
+                if(!(ok = stack_pop(v, &s, ip, W)))
+                    break;
+                if(returned && !stack_equal(out, &s)) {
+                    ok = verify_fail(v, ip, "routine returns with different stacks");
+                    break;
+                }
+                *out = s;
+                returned = true;
+            break;
+
+            case OpJmp:
+                falls = false;
+                work[work_size++] = (stack_work){ *(word*)a, s };
+            break;
+            case OpJmpIn:
+                ok = verify_fail(v, ip, "jump to an address only known at runtime");
+            break;
+            case OpIf: {
+                // the if can be the last thing in the image, and what it skips any byte
+                u8 skipped = next < sizeof(vm->data) ? vm->data[next] : OpCount;
+                work[work_size++] = (stack_work){ next + (skipped < OpCount ? vm_op_sizes[skipped] : 0), s };
+            } break;
+
+            default: {
+                // everything else only touches r0 - r2, branches jump to their last operand
+                const char* kinds = vm_op_operands[op];
+                size_t kinds_size = strlen(kinds);
+                if(kinds_size && kinds[kinds_size-1] == 't')
+                    work[work_size++] = (stack_work){ *(word*)(vm->data + next - W), s };
+            } break;
+        }
+
+        if(ok && falls)
+            work[work_size++] = (stack_work){ next, s };
+    }
+
+    // a routine that never returns never gives control back to its caller
+    if(ok && v->calls_size > 1 && !returned)
+        ok = verify_fail(v, entry, "routine never returns");
+
+    free(seen);
+    free(visited);
+    free(work);
+    --v->calls_size;
+    return ok;
+}
+
+bool vm_verify(vm_t* vm, vm_verify_report* report) {
+    verifier* v = calloc(1, sizeof(verifier));
+    if(!v) {
+        printf("ERROR: Couldn't allocate the verifier\n");
+        vm->verified = false;
+        return false;
+    }
+    v->vm = vm;
+    v->report = report;
+    v->stack_max = vm->sp;
+    if(report)
+        memset(report, 0, sizeof(*report));
+
+    bool ok = verify_code(v);
+    if(report)
+        report->code_ok = ok;
+
+    if(ok) {
+        stack_state in = {
+            .known = KnownSp | KnownBp | KnownSn,
+            .sp = vm->sp,
+            .bp = vm->bp,
+            .sn = *(word*)vm->memory,
+        };
+        stack_state out;
+        ok = verify_stack(v, vm->ip, in, &out);
+        if(report) {
+            report->stack_bounded = ok;
+            report->stack_max = ok ? v->stack_max : 0;
+        }
+    }
+
+    // the unchecked `ret` only lands on these, past the code it's all hlt
+    memset(vm->starts, 0, sizeof(vm->starts));
+    for(u32 ip = 0; ok && ip < sizeof(vm->data); ++ip)
+        if(ip >= v->code_size || v->is_start[ip])
+            vm->starts[ip >> 3] |= 1 << (ip & 7);
+
+    vm->verified = ok;
+    free(v);
+    return ok;
+}
\ No newline at end of file
@@ -1,368 +1,771 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#endif
+
 #include "vm.h"
+#include "channel.h"
+#include "trace.h"
+#include "window.h"
+#include "heap.h"
+
+#include <stddef.h>
+#include <string.h>
 
-#define PEEK_RAM(vm, index) *(u16*)(vm->memory + (index))
-#define PEEK_ROM(vm, index) *(u16*)(vm->data + (index))
+#define PEEK_RAM(vm, index) *(word*)(vm->memory + (index))
+#define PEEK_ROM(vm, index) *(word*)(vm->data + (index))
 
 #ifdef POINTER_DEBUG
-void vm_dump_memory(vm_t* vm, u16 max_memory_index) {
-    for(u16 i = 0; i < max_memory_index; ++i) {
+void vm_dump_memory(vm_t* vm, word max_memory_index) {
+    for(word i = 0; i < max_memory_index; ++i) {
         printf("| 0x%02X | ", *(u8*)(vm->memory+i));
     }
     putchar('\n');
 }
 #endif
 
-u16* vm_get_register(vm_t* vm, u8 index) {
-    switch(index) {
-        // r0 to r2
-        case 0x00:
-            return &vm->r[index];
-        break;
-        case 0x01:
-            return &vm->r[index];
-        break;
-        case 0x02:
-            return &vm->r[index];
-        break;
-        // rsp
-        case 0x03:
-            return &vm->sp;
-        break;
-        // rbp
-        case 0x04:
-            return &vm->bp;
-        break;
-
-        default:
-            printf("index = 0x%02X\n", index);
-            todo("Add more registers!");
-        break;
+#ifdef _WIN32
+// one extra word at the end so reading a word from the last address stays inside
+#define VM_MEMORY_RESERVE (VM_MEMORY_SIZE + sizeof(word))
+#else
+// memory sits between two PROT_NONE guards ( bigger than any host page ), so
+// a word read from the last address or a pop below 0 faults instead, and
+// execute_vm turns the fault into a trap ( see VM_GUARDED )
+#define VM_MEMORY_RESERVE VM_MEMORY_SIZE
+#define VM_GUARD_SIZE     0x10000
+#define VM_GUARDED
+#endif
+
+bool vm_init(vm_t* vm) {
+#ifdef _WIN32
+    vm->memory = VirtualAlloc(NULL, VM_MEMORY_RESERVE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    // anonymous pages are zero filled on the first fault, so a 4 GiB address
+    // space costs nothing until the program actually touches it
+    u8* reserve = mmap(NULL, VM_MEMORY_RESERVE + 2 * VM_GUARD_SIZE, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    vm->memory = NULL;
+    if(reserve != MAP_FAILED) {
+        void* memory = mmap(reserve + VM_GUARD_SIZE, VM_MEMORY_RESERVE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        if(memory != MAP_FAILED)
+            vm->memory = memory;
+        else
+            munmap(reserve, VM_MEMORY_RESERVE + 2 * VM_GUARD_SIZE);
     }
+#endif
+    if(!vm->memory) {
+        printf("ERROR: Couldn't reserve 0x%llX bytes of VM memory\n", (unsigned long long)VM_MEMORY_SIZE);
+        return false;
+    }
+    return true;
+}
+
+void vm_destroy(vm_t* vm) {
+    if(!vm->memory)
+        return;
+    channel_release(vm);
+    window_release(vm);
+    heap_release(vm);
+#ifdef _WIN32
+    VirtualFree(vm->memory, 0, MEM_RELEASE);
+#else
+    munmap(vm->memory - VM_GUARD_SIZE, VM_MEMORY_RESERVE + 2 * VM_GUARD_SIZE);
+#endif
+    vm->memory = NULL;
+}
+
+void vm_reset(vm_t* vm) {
+    channel_release(vm);
+    window_release(vm);
+    heap_release(vm);
+#ifdef POINTER_WIDE
+    // dropping the pages is cheaper than zeroing what could be 4 GiB,
+    // they come back zero filled on the next touch
+#ifdef _WIN32
+    VirtualFree(vm->memory, VM_MEMORY_RESERVE, MEM_DECOMMIT);
+    VirtualAlloc(vm->memory, VM_MEMORY_RESERVE, MEM_COMMIT, PAGE_READWRITE);
+#else
+    madvise(vm->memory, VM_MEMORY_RESERVE, MADV_DONTNEED);
+#endif
+#else
+    memset(vm->memory, 0, VM_MEMORY_RESERVE);
+#endif
+    vm->r[0] = vm->r[1] = vm->r[2] = 0;
+    vm->sp = vm->bp = vm->ip = 0;
+    vm->halted = false;
+    vm->trap = TrapNone;
+    vm->trap_ip = 0;
+    vm->op_ip = 0;
+    vm->scratch = 0;
 }
 
+const char* vm_trap_names[] = {
+    [TrapNone]            = "none",
+    [TrapBadOpcode]       = "bad opcode",
+    [TrapBadRegister]     = "bad register",
+    [TrapBadJump]         = "jump outside of the image",
+    [TrapMemory]          = "memory access out of range",
+    [TrapStackOverflow]   = "stack overflow",
+    [TrapStackUnderflow]  = "stack underflow",
+    [TrapBadExternal]     = "external function not set",
+    [TrapDivideByZero]    = "divide by zero",
+    [TrapChannelReceiver] = "channel has another receiver",
+    [TrapBudget]          = "out of instructions",
+};
+
+// the first trap wins, and stops the VM once the current instruction is done
+void vm_trap(vm_t* vm, u8 trap) {
+    if(!vm->trap)
+        vm->trap = trap;
+    vm->halted = true;
+}
+
+// where every register lives inside of vm_t, by index
+const size_t vm_register_offsets[VM_REGISTERS] = {
+    offsetof(vm_t, r[0]),
+    offsetof(vm_t, r[1]),
+    offsetof(vm_t, r[2]),
+    offsetof(vm_t, sp),
+    offsetof(vm_t, bp),
+};
+
+word* vm_get_register(vm_t* vm, u8 index) {
+    if(index >= VM_REGISTERS) {
+        vm_trap(vm, TrapBadRegister);
+        return &vm->scratch;
+    }
+    return VM_REGISTER(vm, index);
+}
+
+#ifndef VM_GUARDED
+// every address the checked interpreter touches goes through here
+static word* vm_ram(vm_t* vm, word addr) {
+    if((unsigned long long)addr + sizeof(word) > VM_MEMORY_SIZE) {
+        vm_trap(vm, TrapMemory);
+        return &vm->scratch;
+    }
+    return (word*)(vm->memory + addr);
+}
+#endif
+
 u8 vm_popU8_stack(vm_t* vm) {
+    if(vm->sp < 1) {
+        vm_trap(vm, TrapStackUnderflow);
+        return 0;
+    }
     --vm->sp;
     return vm->memory[vm->sp];
 }
 
 void vm_pushU8_stack(vm_t* vm, u8 num) {
+    if(vm->sp + 1 > VM_STACK_SIZE) {
+        vm_trap(vm, TrapStackOverflow);
+        return;
+    }
     vm->memory[vm->sp++] = num;
 }
 
-u16 vm_popU16_stack(vm_t* vm) {
-    vm->sp -= 2;
-    return *(u16*)(vm->memory+vm->sp);
+word vm_popWord_stack(vm_t* vm) {
+    if(vm->sp < sizeof(word)) {
+        vm_trap(vm, TrapStackUnderflow);
+        return 0;
+    }
+    vm->sp -= sizeof(word);
+    return *(word*)(vm->memory+vm->sp);
+}
+
+void vm_pushWord_stack(vm_t* vm, word num) {
+    if((unsigned long long)vm->sp + sizeof(word) > VM_STACK_SIZE) {
+        vm_trap(vm, TrapStackOverflow);
+        return;
+    }
+    *(word*)(vm->memory+vm->sp) = num;
+    vm->sp += sizeof(word);
+}
+
+// jumps to addresses only known at runtime ( ret, jmp_in ) can't be verified,
+// so both interpreters make sure the next instruction is inside of the image
+static void vm_check_jump(vm_t* vm) {
+    if((size_t)vm->ip + VM_MAX_OP_SIZE > sizeof(vm->data))
+        vm_trap(vm, TrapBadJump);
+}
+
+#ifdef VM_GUARDED
+// pops without the underflow check, below 0 is the guard before memory
+static word vm_pop_guarded(vm_t* vm) {
+    word num = *(word*)(vm->memory + (long long)vm->sp - (long long)sizeof(word));
+    vm->sp -= sizeof(word);
+    return num;
+}
+
+static u8 vm_popU8_guarded(vm_t* vm) {
+    u8 num = vm->memory[(long long)vm->sp - 1];
+    --vm->sp;
+    return num;
 }
+#endif
 
-void vm_pushU16_stack(vm_t* vm, u16 num) {
-    *(u16*)(vm->memory+vm->sp) = num;
-    vm->sp += 2;
+static word vm_pop_unchecked(vm_t* vm) {
+    vm->sp -= sizeof(word);
+    return *(word*)(vm->memory+vm->sp);
 }
 
-u16 vm_read_u16(vm_t* vm){
-    u16 value = PEEK_ROM(vm, vm->ip);
-    vm->ip += 2;
+static void vm_push_unchecked(vm_t* vm, word num) {
+    *(word*)(vm->memory+vm->sp) = num;
+    vm->sp += sizeof(word);
+}
+
+// make sure [addr, addr+size) stays inside of memory
+static word vm_clamp_size(word addr, word size) {
+    if((unsigned long long)addr + size > VM_MEMORY_SIZE)
+        return VM_MEMORY_SIZE - addr;
+    return size;
+}
+
+word vm_read_word(vm_t* vm){
+    word value = PEEK_ROM(vm, vm->ip);
+    vm->ip += sizeof(word);
     return value;
 }
 
+#define W sizeof(word)
+
+// size in bytes of every instruction, opcode included ( 0 means unknown opcode )
+const u8 vm_op_sizes[OpCount] = {
+    [OpHlt]         = 1,
+
+    [OpMoveCA]      = 1 + W + W,
+    [OpMoveCR]      = 1 + W + 1,
+    [OpMoveAR]      = 1 + W + 1,
+    [OpMoveRR]      = 1 + 1 + 1,
+
+    [OpAddAC]       = 1 + W + W,
+    [OpAddAA]       = 1 + W + W,
+    [OpAddRC]       = 1 + 1 + W,
+
+    [OpEqAA]        = 1 + W + W,
+
+    [OpPeek]        = 1 + W + W,
+    [OpIf]          = 1 + W,
+    [OpJmp]         = 1 + W,
+    [OpJmpIn]       = 1 + W,
+
+    [OpPushReg]     = 1 + 1,
+    [OpPushAddr]    = 1 + W,
+
+    [OpPopReg]      = 1 + 1,
+    [OpPopAddr]     = 1 + W,
+
+    [OpPushAddrB]   = 1 + W,
+    [OpPopAddrB]    = 1 + W,
+
+    [OpSyscall]     = 1,
+
+    [OpReturn]      = 1,
+    [OpCall]        = 1 + W,
+    [OpLeave]       = 1,
+
+    [OpEnter]       = 1 + W,
+    [OpMoveCF]      = 1 + W + 1 + W,
+    [OpMoveFR]      = 1 + 1 + W + 1,
+    [OpMoveRF]      = 1 + 1 + 1 + W,
+    [OpAddFC]       = 1 + 1 + W + W,
+    [OpPushFrame]   = 1 + 1 + W,
+    [OpPopFrame]    = 1 + 1 + W,
+
+    [OpJz]          = 1 + W + W,
+    [OpJnz]         = 1 + W + W,
+    [OpJzR]         = 1 + 1 + W,
+    [OpJnzR]        = 1 + 1 + W,
+    [OpJeqAA]       = 1 + W + W + W,
+    [OpJltAA]       = 1 + W + W + W,
+    [OpJgtAA]       = 1 + W + W + W,
+    [OpJeqRR]       = 1 + 1 + 1 + W,
+    [OpJltRR]       = 1 + 1 + 1 + W,
+    [OpJgtRR]       = 1 + 1 + 1 + W,
+
+    [OpSubRR]       = 1 + 1 + 1,
+    [OpSubRC]       = 1 + 1 + W,
+    [OpSubAA]       = 1 + W + W,
+    [OpMulRR]       = 1 + 1 + 1,
+    [OpMulRC]       = 1 + 1 + W,
+    [OpMulAA]       = 1 + W + W,
+    [OpAndRR]       = 1 + 1 + 1,
+    [OpAndRC]       = 1 + 1 + W,
+    [OpAndAA]       = 1 + W + W,
+    [OpOrRR]        = 1 + 1 + 1,
+    [OpOrRC]        = 1 + 1 + W,
+    [OpOrAA]        = 1 + W + W,
+    [OpXorRR]       = 1 + 1 + 1,
+    [OpXorRC]       = 1 + 1 + W,
+    [OpXorAA]       = 1 + W + W,
+    [OpShlRR]       = 1 + 1 + 1,
+    [OpShlRC]       = 1 + 1 + W,
+    [OpShlAA]       = 1 + W + W,
+    [OpShrRR]       = 1 + 1 + 1,
+    [OpShrRC]       = 1 + 1 + W,
+    [OpShrAA]       = 1 + W + W,
+    [OpLtRR]        = 1 + 1 + 1,
+    [OpLtRC]        = 1 + 1 + W,
+    [OpLtAA]        = 1 + W + W,
+    [OpLtsRR]       = 1 + 1 + 1,
+    [OpLtsRC]       = 1 + 1 + W,
+    [OpLtsAA]       = 1 + W + W,
+    [OpAddRR]       = 1 + 1 + 1,
+    [OpDivRR]       = 1 + 1 + 1,
+    [OpDivRC]       = 1 + 1 + W,
+    [OpDivAA]       = 1 + W + W,
+    [OpNotR]        = 1 + 1,
+    [OpNotA]        = 1 + W,
+};
+
+#undef W
+
+const char* vm_op_names[OpCount] = {
+    [OpHlt]         = "hlt",
+
+    [OpMoveCA]      = "mov.ca",
+    [OpMoveCR]      = "mov.cr",
+    [OpMoveAR]      = "mov.ar",
+    [OpMoveRR]      = "mov.rr",
+
+    [OpAddAC]       = "add.ac",
+    [OpAddAA]       = "add.aa",
+    [OpAddRC]       = "add.rc",
+
+    [OpEqAA]        = "eq.aa",
+
+    [OpPeek]        = "peek",
+    [OpIf]          = "if",
+    [OpJmp]         = "jmp",
+    [OpJmpIn]       = "jmp_in",
+
+    [OpPushReg]     = "push.r",
+    [OpPushAddr]    = "push.a",
+
+    [OpPopReg]      = "pop.r",
+    [OpPopAddr]     = "pop.a",
+
+    [OpPushAddrB]   = "pushb",
+    [OpPopAddrB]    = "popb",
+
+    [OpSyscall]     = "sys",
+
+    [OpReturn]      = "ret",
+    [OpCall]        = "call",
+    [OpLeave]       = "leave",
+
+    [OpEnter]       = "enter",
+    [OpMoveCF]      = "mov.cf",
+    [OpMoveFR]      = "mov.fr",
+    [OpMoveRF]      = "mov.rf",
+    [OpAddFC]       = "add.fc",
+    [OpPushFrame]   = "push.f",
+    [OpPopFrame]    = "pop.f",
+
+    [OpJz]          = "jz.a",
+    [OpJnz]         = "jnz.a",
+    [OpJzR]         = "jz.r",
+    [OpJnzR]        = "jnz.r",
+    [OpJeqAA]       = "jeq.aa",
+    [OpJltAA]       = "jlt.aa",
+    [OpJgtAA]       = "jgt.aa",
+    [OpJeqRR]       = "jeq.rr",
+    [OpJltRR]       = "jlt.rr",
+    [OpJgtRR]       = "jgt.rr",
+
+    [OpSubRR]       = "sub.rr",
+    [OpSubRC]       = "sub.rc",
+    [OpSubAA]       = "sub.aa",
+    [OpMulRR]       = "mul.rr",
+    [OpMulRC]       = "mul.rc",
+    [OpMulAA]       = "mul.aa",
+    [OpAndRR]       = "and.rr",
+    [OpAndRC]       = "and.rc",
+    [OpAndAA]       = "and.aa",
+    [OpOrRR]        = "or.rr",
+    [OpOrRC]        = "or.rc",
+    [OpOrAA]        = "or.aa",
+    [OpXorRR]       = "xor.rr",
+    [OpXorRC]       = "xor.rc",
+    [OpXorAA]       = "xor.aa",
+    [OpShlRR]       = "shl.rr",
+    [OpShlRC]       = "shl.rc",
+    [OpShlAA]       = "shl.aa",
+    [OpShrRR]       = "shr.rr",
+    [OpShrRC]       = "shr.rc",
+    [OpShrAA]       = "shr.aa",
+    [OpLtRR]        = "lt.rr",
+    [OpLtRC]        = "lt.rc",
+    [OpLtAA]        = "lt.aa",
+    [OpLtsRR]       = "lts.rr",
+    [OpLtsRC]       = "lts.rc",
+    [OpLtsAA]       = "lts.aa",
+    [OpAddRR]       = "add.rr",
+    [OpDivRR]       = "divmod.rr",
+    [OpDivRC]       = "divmod.rc",
+    [OpDivAA]       = "divmod.aa",
+    [OpNotR]        = "not.r",
+    [OpNotA]        = "not.a",
+};
+
+const char* vm_op_operands[OpCount] = {
+    [OpHlt]         = "",
+
+    [OpMoveCA]      = "ca",
+    [OpMoveCR]      = "cr",
+    [OpMoveAR]      = "ar",
+    [OpMoveRR]      = "rr",
+
+    [OpAddAC]       = "ac",
+    [OpAddAA]       = "aa",
+    [OpAddRC]       = "rc",
+
+    [OpEqAA]        = "aa",
+
+    [OpPeek]        = "aa",
+    [OpIf]          = "a",
+    [OpJmp]         = "t",
+    [OpJmpIn]       = "a",
+
+    [OpPushReg]     = "r",
+    [OpPushAddr]    = "a",
+
+    [OpPopReg]      = "r",
+    [OpPopAddr]     = "a",
+
+    [OpPushAddrB]   = "a",
+    [OpPopAddrB]    = "a",
+
+    [OpSyscall]     = "",
+
+    [OpReturn]      = "",
+    [OpCall]        = "t",
+    [OpLeave]       = "",
+
+    [OpEnter]       = "c",
+    [OpMoveCF]      = "cf",
+    [OpMoveFR]      = "fr",
+    [OpMoveRF]      = "rf",
+    [OpAddFC]       = "fc",
+    [OpPushFrame]   = "f",
+    [OpPopFrame]    = "f",
+
+    [OpJz]          = "at",
+    [OpJnz]         = "at",
+    [OpJzR]         = "rt",
+    [OpJnzR]        = "rt",
+    [OpJeqAA]       = "aat",
+    [OpJltAA]       = "aat",
+    [OpJgtAA]       = "aat",
+    [OpJeqRR]       = "rrt",
+    [OpJltRR]       = "rrt",
+    [OpJgtRR]       = "rrt",
+
+    [OpSubRR]       = "rr",
+    [OpSubRC]       = "rc",
+    [OpSubAA]       = "aa",
+    [OpMulRR]       = "rr",
+    [OpMulRC]       = "rc",
+    [OpMulAA]       = "aa",
+    [OpAndRR]       = "rr",
+    [OpAndRC]       = "rc",
+    [OpAndAA]       = "aa",
+    [OpOrRR]        = "rr",
+    [OpOrRC]        = "rc",
+    [OpOrAA]        = "aa",
+    [OpXorRR]       = "rr",
+    [OpXorRC]       = "rc",
+    [OpXorAA]       = "aa",
+    [OpShlRR]       = "rr",
+    [OpShlRC]       = "rc",
+    [OpShlAA]       = "aa",
+    [OpShrRR]       = "rr",
+    [OpShrRC]       = "rc",
+    [OpShrAA]       = "aa",
+    [OpLtRR]        = "rr",
+    [OpLtRC]        = "rc",
+    [OpLtAA]        = "aa",
+    [OpLtsRR]       = "rr",
+    [OpLtsRC]       = "rc",
+    [OpLtsAA]       = "aa",
+    [OpAddRR]       = "rr",
+    [OpDivRR]       = "rr",
+    [OpDivRC]       = "rc",
+    [OpDivAA]       = "aa",
+    [OpNotR]        = "r",
+    [OpNotA]        = "a",
+};
+
+// an unknown opcode is left in place, so the interpreter traps on it next
 void vm_skip_instruction(vm_t* vm){
-    u8 op = vm->data[vm->ip++];
+    // past the image there's nothing to skip, the checked loop traps on the
+    // next fetch ( and the verifier doesn't let verified images get here )
+    if(vm->ip >= sizeof(vm->data))
+        return;
+    u8 op = vm->data[vm->ip];
+    if(op < OpCount)
+        vm->ip += vm_op_sizes[op];
+}
 
-    switch(op) {
-        case OpHlt: {} break;
+const vm_syscall_effect vm_syscall_effects[VM_SYSCALLS] = {
+    [0x00] = { 1,                0,            false, false },
+    [0x01] = { 0,                1,            false, false },
+    [0x02] = { 1,                0,            false, true  },
+    [0x03] = { 2 * sizeof(word), 0,            false, false },
+    [0x04] = { 3 * sizeof(word), 0,            false, false },
+    [0x05] = { 3 * sizeof(word), sizeof(word), true,  false },
+    [0x06] = { 3 * sizeof(word), sizeof(word), true,  false },
+    // windows never cover the stack, so *0x00 stays put
+    [0x07] = { 4 * sizeof(word), sizeof(word), false, false },
+    [0x08] = { 2 * sizeof(word), sizeof(word), false, false },
+    [0x09] = { 1 * sizeof(word), 0,            false, false },
+    // neither does the heap, realloc only copies inside of it
+    [0x0A] = { 2 * sizeof(word), 0,            false, false },
+    [0x0B] = { 1 * sizeof(word), sizeof(word), false, false },
+    [0x0C] = { 1 * sizeof(word), 0,            false, false },
+    [0x0D] = { 2 * sizeof(word), sizeof(word), false, false },
+};
+
+u8 vm_io_get(vm_io* io) {
+    if(!io)
+        return getchar();
+    return io->in_at < io->in_size ? io->in[io->in_at++] : EOF;
+}
 
-        // mov <constant>, <ptr>
-        case OpMoveCA: {
-            vm->ip += 2;
-            vm->ip += 2;
-        } break;
-        // mov <ptr>, <register>
-        case OpMoveAR: {
-            vm->ip += 2;
-            vm->ip += 2;
+void vm_io_put(vm_io* io, u8 c) {
+    if(!io) {
+        putchar(c);
+        return;
+    }
+    if(io->out_size == io->out_capacity) {
+        if(io->out_capacity >= VM_IO_MAX_OUT)
+            return;
+        u32 capacity = io->out_capacity ? io->out_capacity * 2 : 0x100;
+        u8* out = realloc(io->out, capacity);
+        if(!out)
+            return;
+        io->out = out;
+        io->out_capacity = capacity;
+    }
+    io->out[io->out_size++] = c;
+}
+
+// a wait that ran out of budget puts back the `popped` bytes of arguments and
+// the ip of the sys, so running the VM again with more budget waits again
+// ( evicted batch instances take turns on the workers like that, see batch.c )
+static void vm_syscall_retry(vm_t* vm, word popped) {
+    vm->sp += popped;
+    vm->ip -= vm_op_sizes[OpSyscall];
+    vm_trap(vm, TrapBudget);
+}
+
+// the syscall number is read from *0x00, arguments are popped from the stack
+void vm_syscall(vm_t* vm) {
+    word sn = PEEK_RAM(vm, 0);
+    switch(sn) {
+        // syscall 0x00 -> print character to stdout
+        case 0x00: {
+            vm_io_put(vm->io, vm_popU8_stack(vm));
         } break;
-        // mov <constant>, <register>
-        case OpMoveCR: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x01 -> read character from stdin, and push onto the stack
+        case 0x01: {
+            vm_pushU8_stack(vm, vm_io_get(vm->io));
         } break;
-        // mov <register>, <register>
-        case OpMoveRR: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x02 -> call outsider function
+        case 0x02: {
+            u8 function_index = vm_popU8_stack(vm);
+            if(function_index >= sizeof(vm->external)/sizeof(*vm->external) || !vm->external[function_index]) {
+                vm_trap(vm, TrapBadExternal);
+                break;
+            }
+            vm->external[function_index](vm);
         } break;
-            
-        // add <Aptr>, <Bptr>
-        case OpAddAA: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x03 -> create channel, pops <id> and <capacity>
+        case 0x03: {
+            word id = vm_popWord_stack(vm);
+            word capacity = vm_popWord_stack(vm);
+            channel_open(id, capacity);
         } break;
-        
-        // add <ptr>, <const>
-        case OpAddAC: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x04 -> send, pops <id>, <addr> and <size>, waits while the channel is full
+        // ( waiting spends the budget, see vm_syscall_retry )
+        case 0x04: {
+            channel* ch = channel_get(vm_popWord_stack(vm));
+            word addr = vm_popWord_stack(vm);
+            word size = vm_clamp_size(addr, vm_popWord_stack(vm));
+            if(ch && !channel_send(ch, vm->memory + addr, size, &vm->budget))
+                vm_syscall_retry(vm, 3 * sizeof(word));
         } break;
-        
-        // add <register>, <const>
-        case OpAddRC: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x05 -> receive, pops <id>, <addr> and <max size>, waits for a message
+        // and pushes the amount of bytes received
+        case 0x05: {
+            channel* ch = channel_get(vm_popWord_stack(vm));
+            word addr = vm_popWord_stack(vm);
+            word size = vm_clamp_size(addr, vm_popWord_stack(vm));
+            if(ch && !channel_claim(ch, vm)) {
+                vm_trap(vm, TrapChannelReceiver);
+                break;
+            }
+            word received = 0;
+            if(ch && !channel_recv(ch, vm->memory + addr, size, &received, &vm->budget)) {
+                vm_syscall_retry(vm, 3 * sizeof(word));
+                break;
+            }
+            vm_pushWord_stack(vm, received);
         } break;
-        
-        // add <Aptr>, <Bptr>
-        case OpEqAA: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x06 -> try receive, same as 0x05 but pushes -1 ( 0xFFFF ) when the channel is empty
+        case 0x06: {
+            channel* ch = channel_get(vm_popWord_stack(vm));
+            word addr = vm_popWord_stack(vm);
+            word size = vm_clamp_size(addr, vm_popWord_stack(vm));
+            if(ch && !channel_claim(ch, vm)) {
+                vm_trap(vm, TrapChannelReceiver);
+                break;
+            }
+            word received = (word)-1;
+            if(ch && !channel_try_recv(ch, vm->memory + addr, size, &received))
+                received = (word)-1;
+            vm_pushWord_stack(vm, received);
         } break;
-        
-        // peek <ptr2>, <ptr1>
-        case OpPeek: {
-            vm->ip += 2;
-            vm->ip += 2;
+        // syscall 0x07 -> map a window of a host file, pops <file>, <addr>, <size> and <page>
+        // pushes the bytes of the file in the window ( see window.h )
+        case 0x07: {
+            word file = vm_popWord_stack(vm);
+            word addr = vm_popWord_stack(vm);
+            word size = vm_popWord_stack(vm);
+            word page = vm_popWord_stack(vm);
+            vm_pushWord_stack(vm, window_map(vm, file, addr, size, page));
         } break;
-            
-        // if <ptr>
-        case OpIf: {
-            vm->ip += 2;
+        // syscall 0x08 -> slide a window to another page of its file, pops <addr> and <page>
+        case 0x08: {
+            word addr = vm_popWord_stack(vm);
+            word page = vm_popWord_stack(vm);
+            vm_pushWord_stack(vm, window_slide(vm, addr, page));
         } break;
-            
-        // jmp <addr>
-        case OpJmp: {
-            vm->ip += 2;
+        // syscall 0x09 -> unmap a window, pops <addr>
+        case 0x09: {
+            window_unmap(vm, vm_popWord_stack(vm));
         } break;
-            
-        // jmp_in <addr>
-        case OpJmpIn: {
-            vm->ip += 2;
+        // syscall 0x0A -> set up the heap, pops <addr> and <size> ( see heap.h )
+        case 0x0A: {
+            word addr = vm_popWord_stack(vm);
+            word size = vm_popWord_stack(vm);
+            heap_init(vm, addr, size);
         } break;
-        
-        // push <addr>
-        case OpPushAddr: {
-            vm->ip += 2;
+        // syscall 0x0B -> alloc, pops <size> and pushes the address, 0 when out of room
+        case 0x0B: {
+            vm_pushWord_stack(vm, heap_alloc(vm, vm_popWord_stack(vm)));
         } break;
-
-        // push <register>
-        case OpPushReg: {
-            ++vm->ip;
+        // syscall 0x0C -> free, pops <addr>
+        case 0x0C: {
+            heap_free(vm, vm_popWord_stack(vm));
         } break;
-
-        // pop <addr>
-        case OpPopAddr: {
-            vm->ip += 2;
-        } break;
-
-        // pop <register>
-        case OpPopReg: {
-            ++vm->ip;
-        } break;
-
-        
-        // pushb <addr>
-        case OpPushAddrB: {
-            vm->ip += 2;
-        } break;
-
-        // popb <addr>
-        case OpPopAddrB: {
-            ++vm->ip;
+        // syscall 0x0D -> realloc, pops <addr> and <size>, pushes the new address
+        case 0x0D: {
+            word addr = vm_popWord_stack(vm);
+            word size = vm_popWord_stack(vm);
+            vm_pushWord_stack(vm, heap_realloc(vm, addr, size));
         } break;
+    }
+}
 
-        // ret
-        case OpReturn: {} break;
-        
-        // leave
-        case OpLeave: {} break;
-        
-        // call <addr>
-        case OpCall: {
-            vm->ip += 2;
-        } break;
+#define VM_CHECKED 1
+#include "execute.inc"
+#undef VM_CHECKED
+
+#define VM_CHECKED 0
+#define VM_BUDGETED 0
+#include "execute.inc"
+#undef VM_BUDGETED
+
+#define VM_BUDGETED 1
+#include "execute.inc"
+#undef VM_BUDGETED
+#undef VM_CHECKED
+
+#ifdef VM_GUARDED
+typedef struct vm_guard vm_guard;
+
+// the VM running on this thread, and where to go when it hits a guard
+struct vm_guard {
+    vm_t* vm;
+    sigjmp_buf jump;
+};
+
+static __thread vm_guard* vm_guard_current;
+static struct sigaction vm_guard_previous[2]; // SIGSEGV, SIGBUS
+static pthread_once_t vm_guard_once = PTHREAD_ONCE_INIT;
+
+static void vm_guard_fault(int sig, siginfo_t* info, void* context) {
+    vm_guard* g = vm_guard_current;
+    if(g) {
+        u8* at = info->si_addr;
+        u8* memory = g->vm->memory;
+        if(at >= memory - VM_GUARD_SIZE && at < memory)
+            siglongjmp(g->jump, TrapStackUnderflow);
+        if(at >= memory + VM_MEMORY_RESERVE && at < memory + VM_MEMORY_RESERVE + VM_GUARD_SIZE)
+            siglongjmp(g->jump, TrapMemory);
+    }
 
+    // not a VM access, whoever had the signal before gets it
+    struct sigaction* previous = &vm_guard_previous[sig == SIGBUS];
+    if(previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(sig, info, context);
+    } else if(previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN) {
+        previous->sa_handler(sig);
+    } else {
+        // the access runs again once this returns, and takes the process down
+        sigaction(sig, previous, NULL);
+    }
+}
 
-        // sys        
-        case OpSyscall: {} break;
+static void vm_guard_install(void) {
+    // SA_NODEFER so leaving with siglongjmp doesn't leave the signal blocked
+    struct sigaction action = { .sa_sigaction = vm_guard_fault, .sa_flags = SA_SIGINFO | SA_NODEFER };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &vm_guard_previous[0]);
+    sigaction(SIGBUS, &action, &vm_guard_previous[1]);
+}
 
-        default: todo("Implement!"); break;
-    }
+// verified images are a straight run of instructions, so the one a fault
+// happened in can be found again from the ip it left behind
+static word vm_instruction_at(vm_t* vm, word ip) {
+    word at = 0;
+    while(at + vm_op_sizes[vm->data[at]] < ip)
+        at += vm_op_sizes[vm->data[at]];
+    return at;
 }
+#endif
 
+// images vm_verify accepted run without any runtime check, the rest
+// with the checks the guard pages can't do for them
 void execute_vm(vm_t* vm) {
-    do {
-        u8 op = vm->data[vm->ip++];
-
-        // printf("op = 0x%02X\n", op);
-        // printf("ip = 0x%04X\n", vm->ip);
-        
-        switch(op) {
-            case OpHlt: {
-                vm->halted = true;
-            } break;
-
-            // mov <constant>, <ptr>
-            case OpMoveCA: {
-                u16 value   = vm_read_u16(vm);
-                u16 ptr     = vm_read_u16(vm);
-
-                printf("ptr = 0x%04X\n", ptr);
-                printf("value = 0x%02X\n", value);
-
-                PEEK_RAM(vm, ptr) = value;
-
-                printf("PEEK_RAM(vm, ptr) = 0x%02X\n", PEEK_RAM(vm, ptr));
-            } break;
-            // mov <constant>, <register>
-            case OpMoveCR: {
-                u16 value   = vm_read_u16(vm);
-                u16* reg     = vm_get_register(vm, vm->data[vm->ip++]);
-
-                *reg = value;
-            } break;
-            // mov <ptr>, <register>
-            case OpMoveAR: {
-                u16 ptr   = vm_read_u16(vm);
-                u16* reg     = vm_get_register(vm, vm->data[vm->ip++]);
-
-                *reg = PEEK_RAM(vm, ptr);
-            } break;
-            // mov <register>, <register>
-            case OpMoveRR: {
-                u16* regB     = vm_get_register(vm, vm->data[vm->ip++]);
-                u16* regA     = vm_get_register(vm, vm->data[vm->ip++]);
-
-                *regA = *regB;
-            } break;
-
-            case OpAddAC: {
-                u16 ptr     = vm_read_u16(vm);
-                vm->r[0] = PEEK_RAM(vm, ptr) + vm_read_u16(vm);
-            } break;  // r0 = *addr  + const
-            
-            case OpAddAA: {
-                u16 ptrA     = vm_read_u16(vm);
-                u16 ptrB     = vm_read_u16(vm);
-
-                vm->r[0] = PEEK_RAM(vm, ptrA) + PEEK_RAM(vm, ptrB); 
-            } break;  // r0 = *addr1 + *addr2
-            
-            case OpAddRC: {
-                u16* reg     = vm_get_register(vm, vm->data[vm->ip++]);
-                vm->r[0] = *reg + vm_read_u16(vm);
-            } break;  // r0 =  reg   + const
-
-            case OpEqAA: {
-                u16 ptrA     = vm_read_u16(vm);
-                u16 ptrB     = vm_read_u16(vm);
-
-                vm->r[0] = PEEK_RAM(vm, ptrA) == PEEK_RAM(vm, ptrB); 
-            } break;   // r0 = *addr1 == *addr2
-            
-            // peek <ptr2>, <ptr1>
-            case OpPeek: {
-                u16 ptr2    = vm_read_u16(vm);
-                u16 ptr1    = vm_read_u16(vm);
-                PEEK_RAM(vm, ptr1) = PEEK_RAM(vm, ptr2);
-            } break;
-            
-            // if <ptr>
-            case OpIf: {
-                u16 ptr = vm_read_u16(vm);
-                if(PEEK_RAM(vm, ptr))
-                    vm_skip_instruction(vm);
-            } break;
-            
-            // jmp <addr>
-            case OpJmp: {
-                u16 addr = vm_read_u16(vm);
-                vm->ip = addr;
-            } break;
-
-            // jmp_in <addr>
-            case OpJmpIn:
-                vm->ip = PEEK_RAM(vm, vm_read_u16(vm));
-            break;
-
-            // ret
-            case OpReturn:
-                vm->ip = vm->memory[vm->sp--];
-            break;
-
-            // leave
-            case OpLeave:
-                vm->sp = vm->bp;
-                vm->bp = vm->memory[vm->sp--];
-            break;
-
-            // call <addr>
-            case OpCall: {
-                u16 addr = vm_read_u16(vm);
-                vm->memory[vm->sp++] = vm->ip;
-                vm->ip = addr;
-            } break;
-            
-            // push <addr>
-            case OpPushAddr: {
-                u16 addr = vm_read_u16(vm);
-                vm_pushU16_stack(vm, PEEK_RAM(vm, addr));
-            } break;
-
-            // push <register>
-            case OpPushReg: {
-                u16* reg = vm_get_register(vm, vm->data[vm->ip++]);
-                vm_pushU16_stack(vm, *reg);
-            } break;
-
-            // pop <addr>
-            case OpPopAddr: {
-                u16 addr = vm_read_u16(vm);
-                PEEK_RAM(vm, addr) = vm_popU16_stack(vm);
-            } break;
-            
-            // push <register>
-            case OpPopReg: {
-                u16* reg = vm_get_register(vm, vm->data[vm->ip++]);
-                *reg = vm_popU16_stack(vm);
-            } break;
-            
-            // pushb <addr>
-            case OpPushAddrB: {
-                u16 addr = vm_read_u16(vm);
-                vm_pushU8_stack(vm, PEEK_RAM(vm, addr));
-            } break;
-
-            // popb <addr>
-            case OpPopAddrB: {
-                u16 addr = vm_read_u16(vm);
-                PEEK_RAM(vm, addr) = vm_popU8_stack(vm);
-            } break;
-
-            // sys
-            case OpSyscall: {
-                u16 sn = PEEK_RAM(vm, 0);
-                printf("sn = %d\n", sn);
-                switch(sn) {
-                    // syscall 0x00 -> print character to stdout
-                    case 0x00: {
-                        char c = vm_popU8_stack(vm);
-                        printf("c = %c\n", c);
-                        putchar(c);
-                    } break;
-                    // syscall 0x01 -> read character from stdin, and push onto the stack
-                    case 0x01: {
-                        char c = getchar();
-                        vm_pushU8_stack(vm, c);
-                    } break;
-                    // syscall 0x02 -> call outsider function
-                    case 0x02: {
-                        u8 function_index = vm_popU8_stack(vm);
-                        vm->external[function_index](vm);
-                    } break;
-                }
-            }break;
-
-            default:
-                todo("Implement!");
-            break;
-        }
-    }while(!vm->halted);
+#ifdef VM_GUARDED
+    pthread_once(&vm_guard_once, vm_guard_install);
+    // a VM can run another one from an external function
+    vm_guard guard = { .vm = vm };
+    vm_guard* outer = vm_guard_current;
+    int trap = sigsetjmp(guard.jump, 0);
+    if(trap) {
+        vm_guard_current = outer;
+        vm_trap(vm, trap);
+        vm->trap_ip = vm->verified ? vm_instruction_at(vm, vm->ip) : vm->op_ip;
+        return;
+    }
+    vm_guard_current = &guard;
+#endif
+    if(vm->verified && vm->budget)
+        execute_vm_budgeted(vm);
+    else if(vm->verified)
+        execute_vm_unchecked(vm);
+    else
+        execute_vm_checked(vm);
+#ifdef VM_GUARDED
+    vm_guard_current = outer;
+#endif
 }
\ No newline at end of file
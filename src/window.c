@@ -0,0 +1,238 @@
+#include <string.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "window.h"
+
+#define WINDOW_FAIL ((word)-1)
+
+typedef struct window_file window_file;
+typedef struct window window;
+
+struct window_file {
+    int fd;         // -1 when nothing is attached
+    bool writable;
+};
+
+struct window {
+    bool used;
+    bool mapped;    // mmap'd, otherwise it was copied in
+    u8 file;
+    word addr;
+    word size;      // what the program asked for
+    word page;
+    u32 valid;      // bytes of the file inside of the window
+};
+
+struct windows {
+    window_file files[WINDOW_FILES];
+    window slots[WINDOW_MAX];
+};
+
+#define PAGES(bytes) (((unsigned long long)(bytes) + WINDOW_PAGE - 1) / WINDOW_PAGE * WINDOW_PAGE)
+
+static long long file_size(int fd) {
+#ifdef _WIN32
+    return _filelengthi64(fd);
+#else
+    struct stat st;
+    return fstat(fd, &st) ? -1 : (long long)st.st_size;
+#endif
+}
+
+static bool file_io(int fd, u8* buf, u32 size, unsigned long long offset, bool write) {
+    while(size) {
+#ifdef _WIN32
+        if(_lseeki64(fd, offset, SEEK_SET) < 0)
+            return false;
+        int done = write ? _write(fd, buf, size) : _read(fd, buf, size);
+#else
+        ssize_t done = write ? pwrite(fd, buf, size, offset) : pread(fd, buf, size, offset);
+#endif
+        if(done <= 0)
+            return false;
+        buf += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+// mmap only works when the host pages are the same size as window pages
+static bool window_can_mmap(void) {
+#ifdef _WIN32
+    return false;
+#else
+    static long page_size;
+    if(!page_size)
+        page_size = sysconf(_SC_PAGESIZE);
+    return page_size == WINDOW_PAGE;
+#endif
+}
+
+// back to zeroed memory, fresh anonymous pages when the window was mmap'd
+static void window_clear(vm_t* vm, window* w) {
+    unsigned long long span = PAGES(w->size);
+#ifndef _WIN32
+    if(w->mapped) {
+        mmap(vm->memory + w->addr, span, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        w->mapped = false;
+        return;
+    }
+#endif
+    memset(vm->memory + w->addr, 0, span);
+}
+
+static void window_unload(vm_t* vm, window* w) {
+    window_file* f = &vm->windows->files[w->file];
+    if(!w->mapped && f->writable && w->valid)
+        file_io(f->fd, vm->memory + w->addr, w->valid, (unsigned long long)w->page * WINDOW_PAGE, true);
+    window_clear(vm, w);
+}
+
+static word window_load(vm_t* vm, window* w) {
+    window_file* f = &vm->windows->files[w->file];
+    unsigned long long offset = (unsigned long long)w->page * WINDOW_PAGE;
+    long long size = file_size(f->fd);
+    if(size < 0)
+        return WINDOW_FAIL;
+
+    w->valid = (unsigned long long)size <= offset ? 0 :
+        (unsigned long long)size - offset < w->size ? (u32)(size - offset) : w->size;
+    if(!w->valid)
+        return 0;
+
+#ifndef _WIN32
+    if(window_can_mmap()) {
+        // only the pages the file covers, touching a page past its end is a SIGBUS
+        void* at = mmap(vm->memory + w->addr, PAGES(w->valid), PROT_READ | PROT_WRITE,
+            (f->writable ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, f->fd, offset);
+        if(at != MAP_FAILED) {
+            w->mapped = true;
+            return w->valid;
+        }
+    }
+#endif
+    if(!file_io(f->fd, vm->memory + w->addr, w->valid, offset, false)) {
+        memset(vm->memory + w->addr, 0, w->valid);
+        w->valid = 0;
+        return WINDOW_FAIL;
+    }
+    return w->valid;
+}
+
+static window* window_find(vm_t* vm, word addr) {
+    if(!vm->windows)
+        return NULL;
+    for(int i = 0; i < WINDOW_MAX; ++i) {
+        window* w = &vm->windows->slots[i];
+        if(w->used && w->addr == addr)
+            return w;
+    }
+    return NULL;
+}
+
+bool window_attach(vm_t* vm, u8 index, const char* path, bool writable) {
+    if(index >= WINDOW_FILES) {
+        printf("ERROR: File index %u is past the %u files a VM can have\n", index, WINDOW_FILES);
+        return false;
+    }
+    if(!vm->windows) {
+        vm->windows = calloc(1, sizeof(windows));
+        if(!vm->windows)
+            return false;
+        for(int i = 0; i < WINDOW_FILES; ++i)
+            vm->windows->files[i].fd = -1;
+    }
+
+#ifdef _WIN32
+    int fd = _open(path, (writable ? _O_RDWR : _O_RDONLY) | _O_BINARY);
+#else
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+#endif
+    if(fd < 0) {
+        printf("ERROR: Couldn't open file %s\n", path);
+        return false;
+    }
+
+    // whatever was mapped from the old file goes away with it
+    window_file* f = &vm->windows->files[index];
+    if(f->fd >= 0) {
+        for(int i = 0; i < WINDOW_MAX; ++i) {
+            window* w = &vm->windows->slots[i];
+            if(w->used && w->file == index) {
+                window_unload(vm, w);
+                w->used = false;
+            }
+        }
+        close(f->fd);
+    }
+    f->fd = fd;
+    f->writable = writable;
+    return true;
+}
+
+void window_release(vm_t* vm) {
+    if(!vm->windows)
+        return;
+    for(int i = 0; i < WINDOW_MAX; ++i) {
+        window* w = &vm->windows->slots[i];
+        if(w->used)
+            window_unload(vm, w);
+    }
+    for(int i = 0; i < WINDOW_FILES; ++i)
+        if(vm->windows->files[i].fd >= 0)
+            close(vm->windows->files[i].fd);
+    free(vm->windows);
+    vm->windows = NULL;
+}
+
+word window_map(vm_t* vm, word file, word addr, word size, word page) {
+    if(!vm->windows || file >= WINDOW_FILES || vm->windows->files[file].fd < 0)
+        return WINDOW_FAIL;
+    // the stack ( and the syscall number at *0x00 ) never move under the program
+    if(!size || addr % WINDOW_PAGE || addr < VM_STACK_SIZE || addr + PAGES(size) > VM_MEMORY_SIZE)
+        return WINDOW_FAIL;
+
+    window* slot = NULL;
+    for(int i = 0; i < WINDOW_MAX; ++i) {
+        window* w = &vm->windows->slots[i];
+        if(!w->used) {
+            slot = slot ? slot : w;
+            continue;
+        }
+        if(addr < w->addr + PAGES(w->size) && w->addr < addr + PAGES(size))
+            return WINDOW_FAIL;
+    }
+    if(!slot)
+        return WINDOW_FAIL;
+
+    // the window starts out zeroed, whatever the program had there is gone
+    *slot = (window){ .used = true, .mapped = window_can_mmap(), .file = file, .addr = addr, .size = size, .page = page };
+    window_clear(vm, slot);
+    return window_load(vm, slot);
+}
+
+word window_slide(vm_t* vm, word addr, word page) {
+    window* w = window_find(vm, addr);
+    if(!w)
+        return WINDOW_FAIL;
+    window_unload(vm, w);
+    w->page = page;
+    return window_load(vm, w);
+}
+
+void window_unmap(vm_t* vm, word addr) {
+    window* w = window_find(vm, addr);
+    if(!w)
+        return;
+    window_unload(vm, w);
+    w->used = false;
+}
\ No newline at end of file